@@ -0,0 +1,77 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef HPP_AGIMUS_BLENDING_HH
+#define HPP_AGIMUS_BLENDING_HH
+
+#include <vector>
+
+#include <hpp/pinocchio/device.hh>
+#include <hpp/core/fwd.hh>
+
+namespace hpp {
+  namespace agimus {
+    typedef pinocchio::value_type value_type;
+    typedef pinocchio::DevicePtr_t DevicePtr_t;
+    typedef core::PathPtr_t PathPtr_t;
+
+    /// Concatenate paths, replacing each junction by a smooth blend.
+    ///
+    /// Around the junction between two consecutive paths, the last
+    /// \f$ \delta \f$ seconds of the first path and the first \f$ \delta \f$
+    /// seconds of the second one are replaced by a quintic spline that
+    /// matches the configuration, the velocity and the acceleration of the
+    /// paths at both ends. \f$ \delta \f$ starts at the minimum of
+    /// \c duration and of half the length of both paths and is halved until
+    /// the middle of the spline is within \c tolerance of the junction. If
+    /// the tolerance is not reached after 8 halvings, the junction is kept
+    /// as is.
+    ///
+    /// A blend is also halved when it is not valid for \c validation, and
+    /// junctions with a path that has constraints are kept as is, as the
+    /// blend would not satisfy them.
+    ///
+    /// The result moves through the junctions without stopping once it is
+    /// retimed by hpp::agimus::retime.
+    ///
+    /// \param tolerance maximal norm of the difference between the end of a
+    ///        path and the beginning of the next one, and between the
+    ///        junction and the middle of the blend.
+    /// \param duration maximal duration of each path replaced by the blend.
+    /// \param validation validation of the blends, or null.
+    /// \return a core::PathVector. Its time range starts at 0.
+    /// \throw std::invalid_argument if \c paths is empty or if two
+    ///        consecutive paths are not continuous within the tolerance.
+    /// \throw std::runtime_error if a path cannot be evaluated.
+    PathPtr_t blend (const std::vector<PathPtr_t>& paths,
+        const DevicePtr_t& device, value_type tolerance, value_type duration,
+        const core::PathValidationPtr_t& validation);
+  } // namespace agimus
+} // namespace hpp
+
+#endif // HPP_AGIMUS_BLENDING_HH
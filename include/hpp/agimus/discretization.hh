@@ -31,19 +31,28 @@
 
 #include <hpp/util/pointer.hh>
 #include <hpp/pinocchio/device.hh>
+#include <hpp/pinocchio/device-sync.hh>
 #include <hpp/constraints/matrix-view.hh>
 #include <hpp/core/path.hh>
 
+#include <hpp/agimus/kinematics-kernel.hh>
+#include <hpp/agimus/output-sink.hh>
+#include <hpp/agimus/path-evaluator.hh>
+
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
 #include <ros/node_handle.h>
 #include <ros/init.h>
-#include <ros/publisher.h>
 
 namespace hpp {
   namespace agimus {
     typedef pinocchio::value_type value_type;
     typedef pinocchio::Configuration_t Configuration_t;
     typedef pinocchio::vector_t vector_t;
+    typedef pinocchio::vectorOut_t vectorOut_t;
+    typedef pinocchio::size_type size_type;
     typedef pinocchio::DevicePtr_t DevicePtr_t;
     typedef pinocchio::CenterOfMassComputationPtr_t CenterOfMassComputationPtr_t;
     typedef core::PathPtr_t PathPtr_t;
@@ -54,10 +63,14 @@ namespace hpp {
     class Discretization
     {
       public:
+        /// \note SecondDerivative and Feedforward only apply to
+        ///       \ref postureOutputs.
         enum ComputationOption
         {   Position              = 1
           , Derivative            = 2
           , PositionAndDerivative = Position | Derivative
+          , SecondDerivative      = 4
+          , Feedforward           = 8
         };
 
         static DiscretizationPtr_t create (const DevicePtr_t device)
@@ -67,90 +80,1057 @@ namespace hpp {
           return ptr;
         }
 
+        /// Evaluate the path at the given time and publish the result.
+        ///
+        /// Several threads may call this method concurrently. Each call
+        /// evaluates the path in its own pinocchio::DeviceData taken from
+        /// the device pool. Only the publication step is serialized, in the
+        /// order in which the calls were received.
         /// \param time
         void compute (value_type time);
 
+        /// \name Preview evaluations
+        /// These methods do not publish anything and do not wait for
+        /// concurrent calls to compute.
+        /// \{
+
+        /// Configuration of the robot along the path at the given time.
+        Configuration_t configAtTime (value_type time);
+
+        /// Velocity of the robot along the path at the given time.
+        vector_t velocityAtTime (value_type time);
+
+        /// Pose of an operational frame at the given time.
+        /// \return a vector of size 7: translation followed by the quaternion
+        ///         (x, y, z, w).
+        /// \throw std::invalid_argument if the frame does not exist.
+        vector_t framePoseAtTime (const std::string& name, value_type time);
+
+        /// \}
+
+        /// Evaluate the configuration and the velocity in one pass when the
+        /// path type allows it (enabled by default).
+        /// Disabling it is meant to benchmark the gain.
+        /// \sa PathEvaluator
+        void fusedEvaluation (bool enable)
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          fusedEvaluation_ = enable;
+        }
+
+        /// Compute the operational frames with a generated kernel.
+        ///
+        /// When enabled, the forward kinematics of the operational frames
+        /// added so far and of the root joint (if \ref setJointNames found
+        /// a free-flyer) is generated as code specialized for the robot,
+        /// compiled and loaded (see KinematicsKernel). The samples whose
+        /// frames are all in the kernel and that write no center of mass
+        /// then use it instead of pinocchio.
+        /// Frames added afterwards are computed by pinocchio until this
+        /// method is called again. \ref resetTopics drops the kernel.
+        /// \return false if the robot has a joint that is not supported by
+        ///         KinematicsKernel. The frames are then computed by
+        ///         pinocchio.
+        /// \throw std::runtime_error if the kernel cannot be compiled.
+        /// \note the compilation takes a few seconds the first time. The
+        ///       kernel is then cached on disk.
+        bool generatedKinematics (bool enable);
+
+        /// Set the minimal number of concurrent evaluations.
+        /// This grows the pool of pinocchio::DeviceData of the device if
+        /// needed. The pool is never shrunk.
+        void numberOfThreads (size_type n);
+
+        inline void numberOfThreads (int n)
+        {
+          numberOfThreads ((size_type) n);
+        }
+
         inline bool addCenterOfMass (const std::string& name,
             const CenterOfMassComputationPtr_t& c, int option)
         {
           return addCenterOfMass (name, c, (ComputationOption) option);
         }
 
+        /// \param decimation the channels are written once every
+        ///        \c decimation calls to \ref compute. It is ignored if the
+        ///        center of mass was already added.
+        ///        \sa centerOfMassDecimation
         bool addCenterOfMass (const std::string& name,
-            const CenterOfMassComputationPtr_t& c, ComputationOption option);
+            const CenterOfMassComputationPtr_t& c, ComputationOption option,
+            size_type decimation = 1);
 
         inline bool addOperationalFrame (const std::string& name, int option)
         {
           return addOperationalFrame (name, (ComputationOption) option);
         }
 
-        bool addOperationalFrame (const std::string& name, ComputationOption option);
+        /// \param decimation the channels are written once every
+        ///        \c decimation calls to \ref compute. It is ignored if the
+        ///        frame was already added.
+        ///        \sa operationalFrameDecimation
+        bool addOperationalFrame (const std::string& name,
+            ComputationOption option, size_type decimation = 1);
+
+        /// Write the channels of a center of mass once every
+        /// \c decimation calls to \ref compute.
+        /// On the other calls, the center of mass is not computed.
+        /// \return false if no center of mass with this name was added.
+        bool centerOfMassDecimation (const std::string& name,
+            size_type decimation);
+
+        inline bool centerOfMassDecimation (const std::string& name,
+            int decimation)
+        {
+          return centerOfMassDecimation (name, (size_type) decimation);
+        }
+
+        /// Write the channels of an operational frame once every
+        /// \c decimation calls to \ref compute.
+        /// When no frame nor center of mass is written by a call, the forward
+        /// kinematics of the frames is not computed.
+        /// \return false if no operational frame with this name was added.
+        bool operationalFrameDecimation (const std::string& name,
+            size_type decimation);
+
+        inline bool operationalFrameDecimation (const std::string& name,
+            int decimation)
+        {
+          return operationalFrameDecimation (name, (size_type) decimation);
+        }
+
+        /// Publish the joint accelerations and the feedforward torques.
+        ///
+        /// \param option a combination of
+        /// \li SecondDerivative: the acceleration along the path is written
+        ///     in channel "acceleration",
+        /// \li Feedforward: the torques computed by the recursive
+        ///     Newton-Euler algorithm from the configuration, the velocity and
+        ///     the acceleration are written in channel "torque".
+        ///
+        /// Both channels have the layout of channel "velocity", including the
+        /// 6 zeros of the root joint. Position and Derivative are ignored as
+        /// the posture and its velocity are always written.
+        /// \note the precomputed samples are dropped. See \ref cacheSamples.
+        void postureOutputs (ComputationOption option);
+
+        inline void postureOutputs (int option)
+        {
+          postureOutputs ((ComputationOption) option);
+        }
+
+        /// Precompute the samples of the time grid.
+        ///
+        /// When enabled, \ref timeGrid (and thus \ref readSubPath)
+        /// evaluates the path, its derivatives and the torques at all the
+        /// samples of the grid, using as many threads as the pool of the
+        /// device. Then, the calls to \ref compute at the times of the grid
+        /// only compute the forward kinematics needed by the frames and
+        /// centers of mass.
+        /// The precomputed samples are dropped when the path is changed or
+        /// spliced, and they are not used by the streaming thread when the
+        /// time scale is not 1.
+        /// \throw std::runtime_error (from timeGrid) if a sample cannot be
+        ///        computed.
+        void cacheSamples (bool enable);
 
         void resetTopics ();
 
         /// \throw std::runtime_error if a joint is not found in the model.
         void setJointNames (const std::vector<std::string>& names);
 
-        void path (const PathPtr_t& path)
+        /// \name Preview window
+        /// \{
+
+        /// Publish at each sample a window of the next samples.
+        ///
+        /// Each call to \ref compute at time \f$t\f$ writes in channel
+        /// "preview" a matrix with \c size rows. Row \f$i\f$ contains
+        /// \li the time \f$t + i dt\f$, saturated by the end of the path,
+        /// \li the posture, as in channel "position",
+        /// \li the velocity, as in channel "velocity",
+        /// \li the pose of each frame added with \ref addPreviewFrame,
+        ///     as translation and quaternion (x, y, z, w).
+        ///
+        /// The samples are evaluated by each thread calling \ref compute
+        /// before the publication, in a circular buffer of the thread. When
+        /// the calls of a thread follow a time grid of step \c dt, each call
+        /// only evaluates one new sample.
+        /// \param size number of samples of the window. 0 disables the
+        ///        preview.
+        /// \note \ref resetTopics disables the preview.
+        void previewWindow (size_type size, value_type dt);
+
+        inline void previewWindow (int size, value_type dt)
+        {
+          previewWindow ((size_type) size, dt);
+        }
+
+        /// Add the pose of a frame to the preview window.
+        /// \return false if the frame does not exist.
+        bool addPreviewFrame (const std::string& name);
+
+        /// \}
+
+        /// Set the path to sample.
+        /// \sa explicitSpline
+        void path (const PathPtr_t& path);
+
+        /// Replace constrained paths by explicit splines.
+        ///
+        /// When enabled, the paths given to \ref path and \ref splicePath
+        /// that have constraints are converted by
+        /// hpp::agimus::explicitSpline, using as many threads as the pool
+        /// of the device (see \ref numberOfThreads). Sampling them then
+        /// never runs the projector.
+        /// \param resolution maximal duration between two knots of the
+        ///        spline.
+        /// \param tolerance maximal distance between the spline and the path
+        ///        at the middle of each interval between knots.
+        void explicitSpline (bool enable, value_type resolution,
+            value_type tolerance);
+
+        /// Retime the paths before sampling.
+        ///
+        /// When enabled, the paths given to \ref path, \ref readSubPath and
+        /// \ref splicePath are retimed by hpp::agimus::retime, after the
+        /// conversion to explicit splines if any. \ref readSubPath first
+        /// extracts the requested part of the path and then samples the
+        /// whole retimed part. The retimed paths start and end at rest.
+        /// \param velocity velocity limits, of the size of the velocity of
+        ///        the robot. If empty, the limits of the model are used.
+        /// \param acceleration acceleration limits.
+        /// \param jerk jerk limits, possibly empty.
+        /// \sa retimedDurations
+        void retiming (bool enable, const vector_t& velocity,
+            const vector_t& acceleration, const vector_t& jerk);
+
+        /// Durations of the latest path before and after retiming.
+        /// \return a vector of size 2, or empty if no path was retimed.
+        vector_t retimedDurations ();
+
+        /// Continue the current path with another path, from a given time.
+        ///
+        /// The current path is replaced by the concatenation of the current
+        /// path on \f$[0, t_s]\f$ and of \c path. Samples before \f$t_s\f$
+        /// are not modified so the switch is seamless as long as \f$t_s\f$ is
+        /// later than all the times already passed to \ref compute. The end
+        /// of the time grid, if any, is moved to the end of the new path.
+        ///
+        /// \param path the path to execute from \f$t_s\f$.
+        /// \param time the splice time \f$t_s\f$
+        /// \param tolerance maximal norm of the difference of configuration
+        ///        and of velocity between the end of the current path at
+        ///        \f$t_s\f$ and the beginning of \c path.
+        /// \throw std::invalid_argument if the paths are not continuous
+        ///        within the tolerance or if the splice time is not within
+        ///        the current path.
+        /// \throw std::logic_error if a time later than \f$t_s\f$ has
+        ///        already been passed to \ref compute.
+        /// \note the time range of the current path must start at 0 and the
+        ///       time grid must not be backward.
+        void splicePath (const PathPtr_t& path, value_type time,
+            value_type tolerance);
+
+        /// \name Time grid
+        /// \{
+
+        /// Set the times at which the path is sampled.
+        ///
+        /// The grid goes from \c start to \c start + \c length with step
+        /// \c dt. A negative length plays the path backward. The last sample
+        /// is always exactly at \c start + \c length.
+        /// \return the number of samples.
+        size_type timeGrid (value_type start, value_type length,
+            value_type dt);
+
+        /// Set the path and the time grid.
+        /// \sa timeGrid
+        size_type readSubPath (const PathPtr_t& path, value_type start,
+            value_type length, value_type dt);
+
+        /// \name Queue of paths executed without stopping.
+        /// \{
+
+        /// Append a path to the queue.
+        void queuePath (const PathPtr_t& path);
+
+        /// Number of paths in the queue.
+        size_type queueSize ();
+
+        /// Remove all the paths of the queue.
+        void clearQueue ();
+
+        /// Set the path to the blend of the paths of the queue, and the
+        /// time grid to the whole path. The queue is then emptied.
+        ///
+        /// The paths are blended at their junctions by
+        /// hpp::agimus::blend and the result is retimed within the limits
+        /// given to \ref retiming, so that the robot moves through the
+        /// junctions without stopping.
+        /// The blends are validated by the path validation of the problem
+        /// of \ref problemSolver, if set.
+        /// \param tolerance see hpp::agimus::blend
+        /// \param duration see hpp::agimus::blend
+        /// \return the number of samples.
+        /// \throw std::logic_error if the queue is empty or if retiming is
+        ///        disabled.
+        size_type readQueue (value_type dt, value_type tolerance,
+            value_type duration);
+
+        /// Set the problem solver whose path validation checks the blends of
+        /// \ref readQueue. NULL disables the validation.
+        void problemSolver (core::ProblemSolverPtr_t ps);
+
+        /// \}
+
+        /// Number of samples of the time grid. 0 if the grid is not set.
+        size_type numberOfSamples ();
+
+        /// Time of the i-th sample of the time grid.
+        /// \throw std::out_of_range if i is not a valid sample index.
+        value_type timeAtSample (size_type i);
+
+        inline value_type timeAtSample (int i)
+        {
+          return timeAtSample ((size_type) i);
+        }
+
+        /// Compute and publish the i-th sample of the time grid.
+        /// \sa compute
+        void computeSample (size_type i)
+        {
+          compute (timeAtSample (i));
+        }
+
+        inline void computeSample (int i)
+        {
+          computeSample ((size_type) i);
+        }
+
+        /// Compute and publish the i-th sample of the time grid traversed
+        /// with the time scale, as the streaming thread does.
+        ///
+        /// This is meant for callers that pace the samples themselves: call
+        /// it with i = 0, 1, 2... every \c period seconds. Sample 0 is the
+        /// first sample of the grid. Each following one advances along the
+        /// grid by the current time scale, which follows \ref timeScale and
+        /// drops to 0 while \ref collisionStop is true, with the
+        /// acceleration bounded by \ref timeScaleAcceleration.
+        /// \return false, without computing anything, once the previous
+        ///         sample was the last one of the grid.
+        /// \throw std::logic_error if streaming.
+        bool computeScaledSample (size_type i, value_type period);
+
+        inline bool computeScaledSample (int i, value_type period)
+        {
+          return computeScaledSample ((size_type) i, period);
+        }
+
+        /// \}
+
+        /// \name Streaming
+        /// The samples of the time grid are computed by a thread of
+        /// Discretization at a fixed period.
+        /// \{
+
+        /// Start computing the samples of the time grid.
+        ///
+        /// The \c lead first samples are computed immediately, the following
+        /// ones every \c period seconds of the monotonic clock, so that the
+        /// consumer always has \c lead samples in advance. The thread stops
+        /// after the last sample of the grid or on \ref stopStreaming.
+        /// While streaming, \ref compute cannot be called from other threads.
+        /// \throw std::logic_error if already streaming or if the path or
+        ///        the time grid is not set.
+        /// \sa adaptiveLead
+        void startStreaming (value_type period, size_type lead);
+
+        inline void startStreaming (value_type period, int lead)
+        {
+          startStreaming (period, (size_type) lead);
+        }
+
+        /// Stop the streaming thread and wait for it.
+        /// \throw std::runtime_error if the thread stopped because of an
+        ///        error, for instance if the path could not be evaluated.
+        void stopStreaming ();
+
+        bool isStreaming ();
+
+        /// Set the real time mode of the streaming thread.
+        ///
+        /// The real time mode is not supported: the loop of the streaming
+        /// thread locks an internal mutex several times per tick, the sinks
+        /// allocate memory and RosSink publishes through roscpp.
+        /// \throw std::logic_error if \c enable is true.
+        void realTime (bool enable, int priority, int cpu);
+
+        /// Set the speed of the streaming relatively to the time grid.
+        ///
+        /// At each period, the streaming thread advances along the time
+        /// grid by \c scale samples (interpolating the time between grid
+        /// samples) and multiplies the velocities by \c scale. The change
+        /// is taken into account by the next sample produced and the actual
+        /// scale follows \c scale with the acceleration bounded by
+        /// \ref timeScaleAcceleration. A scale of 0 holds the current
+        /// configuration. Time stamps follow the wall clock.
+        ///
+        /// The samples already produced are published and are not
+        /// recomputed, so the consumer applies the new scale after the
+        /// samples produced in advance, that is about lead times period
+        /// seconds later (150 ms with the lead chosen by the trajectory
+        /// publisher), plus the depth of its own queue. Reduce the lead,
+        /// or enable \ref adaptiveLead, to reduce this latency.
+        /// \note this only applies to \ref startStreaming and
+        ///       \ref computeScaledSample, not to \ref compute.
+        void timeScale (value_type scale);
+
+        /// Bound of the variation of the time scale per second.
+        /// A non positive value applies changes of time scale at once.
+        void timeScaleAcceleration (value_type acceleration);
+
+        /// Adapt the lead of the streaming thread.
+        ///
+        /// When enabled, the streaming thread measures the delay between
+        /// the scheduled production time of each sample and the time at
+        /// which it is published. Every 100 samples, the lead is set to the
+        /// smallest number of periods covering the 99th percentile of the
+        /// last 1000 delays, plus one sample, bounded by \c minLead and
+        /// \c maxLead. The \c lead given to \ref startStreaming is used
+        /// until enough delays are measured.
+        ///
+        /// The depths reported by \ref consumerQueueDepth then correct the
+        /// number of samples produced in advance: missing samples are
+        /// produced at once and extra samples delay the next ones.
+        /// \note taken into account by the next call to \ref startStreaming.
+        void adaptiveLead (bool enable, size_type minLead, size_type maxLead);
+
+        inline void adaptiveLead (bool enable, int minLead, int maxLead)
+        {
+          adaptiveLead (enable, (size_type) minLead, (size_type) maxLead);
+        }
+
+        /// Report the number of samples received and not yet applied by the
+        /// consumer of the stream.
+        /// Reports received less than about 100 ms after a correction are
+        /// ignored as they do not account for it yet.
+        /// \sa adaptiveLead
+        void consumerQueueDepth (size_type depth);
+
+        inline void consumerQueueDepth (int depth)
+        {
+          consumerQueueDepth ((size_type) depth);
+        }
+
+        /// Number of samples that the streaming thread currently produces in
+        /// advance.
+        size_type streamLead ();
+
+        /// \}
+
+        /// \name Collision monitor
+        /// A thread of Discretization checks the upcoming samples for
+        /// collisions with the current geometry of the robot, including the
+        /// octrees attached after planning.
+        /// \{
+
+        /// Start or stop the collision monitor.
+        ///
+        /// The monitor checks the configurations of the path between the
+        /// latest time passed to \ref compute and \c horizon seconds later,
+        /// every \c step seconds of path time. Each configuration is checked
+        /// once, unless the path or the geometry changes: in the steady
+        /// state, one configuration is checked per new sample.
+        ///
+        /// When a collision is predicted, \ref collisionStop becomes true
+        /// until \ref clearCollisionStop is called. Meanwhile, the
+        /// streaming thread and \ref computeScaledSample slow down to a stop
+        /// as if the time scale was 0 (see \ref timeScale and
+        /// \ref timeScaleAcceleration), from the next period. Callers of
+        /// \ref compute must check \ref collisionStop themselves.
+        ///
+        /// The horizon must cover the stopping distance: the samples
+        /// produced in advance (the lead of the streaming thread) and the
+        /// deceleration, that is \f$ (l T s + s^2 / (2 a)) \delta / T \f$
+        /// of path time, with \f$ l \f$ the lead, \f$ T \f$ the period,
+        /// \f$ s \f$ the time scale, \f$ a \f$ the bound of its variation
+        /// and \f$ \delta \f$ the step of the time grid. While sampling, the
+        /// monitor extends its horizon to this distance if needed.
+        /// \param step 0 to use the step of the time grid.
+        /// The monitor uses a DeviceData of the pool of the device besides
+        /// the one kept by the streaming thread: the pool is grown to 2
+        /// DeviceData if needed (see \ref numberOfThreads).
+        /// \throw std::invalid_argument if the horizon is shorter than the
+        ///        stopping distance computed with the current settings.
+        /// \throw std::logic_error if streaming with a pool of 1 DeviceData.
+        /// \note the time grid must not be backward.
+        void collisionMonitor (bool enable, value_type horizon,
+            value_type step);
+
+        /// Whether the monitor predicted a collision.
+        bool collisionStop ();
+
+        /// Description of the predicted collision, empty if none.
+        std::string collisionReport ();
+
+        /// Resume after a collision was predicted.
+        /// The streaming thread accelerates back to the time scale set by
+        /// \ref timeScale.
+        void clearCollisionStop ();
+
+        /// Mutex to lock while modifying the geometry of the robot, so that
+        /// the collision monitor does not read it at the same time.
+        static boost::mutex& geometryMutex ();
+
+        /// Notify the collision monitors that the geometry changed, so that
+        /// the configurations already checked are checked again.
+        /// \note must be called with \ref geometryMutex locked.
+        static void geometryChanged ();
+
+        /// Make the streaming threads release their DeviceData and wait
+        /// until \ref geometryMutex is unlocked, so that all the DeviceData
+        /// of the pool can be taken to update their geometry data.
+        /// \param release true before taking the DeviceData, false once
+        ///        they are updated.
+        /// \note must be called with \ref geometryMutex locked.
+        static void releaseDeviceData (bool release);
+
+        /// \}
+
+        /// Attach a time stamp to each sample.
+        ///
+        /// When enabled, each sample also writes in channel "stamp" a vector
+        /// containing
+        /// \li the time of the sample along the path,
+        /// \li the wall clock time (in seconds) at which the sample should be
+        ///     applied by the controller,
+        /// \li the index of the sample, which increases by one from a sample
+        ///     to the next one.
+        ///
+        /// The channel is registered, and its topic advertised, the first
+        /// time stamping is enabled. It is kept when stamping is disabled.
+        ///
+        /// The index is also given to each sink by OutputSink::beginTick, so
+        /// that the values of all the channels can be associated to their
+        /// stamp. The ROS messages have no header: RosSink publishes the
+        /// channels of a sample together, once per sample, except for the
+        /// decimated channels which are published at the indices that are
+        /// multiples of their decimation. A consumer detects lost messages
+        /// from the gaps in the indices.
+        ///
+        /// The deadline of the first sample computed after this call (or
+        /// after the path is changed) is the current time plus \c delay.
+        /// The deadlines of the following samples follow the path time.
+        /// Consumers can then interpolate the references, for instance
+        /// with the functions of interpolation.hh.
+        void timeStamping (bool enable, value_type delay)
         {
-          path_ = path;
+          boost::mutex::scoped_lock lock(mutex_);
+          if (enable && stampChannel_ == noChannel)
+            stampChannel_ = addChannel ("stamp", VectorChannel);
+          stamping_ = enable;
+          stampDelay_ = delay;
+          stampOriginSet_ = false;
         }
 
+        /// Set the prefix of the topics of the ROS output.
+        /// \note It is taken into account by the next call to
+        ///       \ref initializeRosNode.
         void topicPrefix (const std::string& tp)
         {
           topicPrefix_ = tp;
         }
 
+        /// \name Outputs
+        /// \{
+
+        /// Add an output.
+        /// All the channels already registered are added to the sink.
+        void addSink (const OutputSinkPtr_t& sink);
+
+        /// Remove an output. Do nothing if the sink was not added.
+        void removeSink (const OutputSinkPtr_t& sink);
+
+        /// Record the outputs in a file, in addition to the other sinks.
+        /// \sa FileSink
+        void startRecording (const std::string& filename);
+
+        void stopRecording ();
+
+        /// Initialize ROS and add a RosSink to the outputs.
         bool initializeRosNode (const std::string& name, bool anonymous);
 
+        /// Remove the RosSink and shutdown ROS.
         void shutdownRos ();
 
+        /// \}
+
         ~Discretization();
 
       private:
+        /// Forward kinematics needed by a sample.
+        enum Kinematics {
+          NoKinematics,
+          /// Placement of the joints.
+          JointKinematics,
+          /// Placement and velocity of the frames.
+          FrameKinematics,
+          /// Placement and velocity of the frames and of the root joint,
+          /// computed by \ref kernel_. The placements in the device are not
+          /// updated.
+          CompiledKinematics
+        };
+
+        /// Identifier of the root joint in \ref kernel_.
+        static const std::size_t rootTarget = (std::size_t) -1;
+
+        /// Samples of the time grid computed in advance.
+        /// \sa cacheSamples
+        struct Cache {
+          PathPtr_t path;
+          /// Combination of SecondDerivative and Feedforward.
+          int outputs;
+          value_type dt;
+          std::vector<value_type> times;
+          /// One column per sample.
+          pinocchio::matrix_t q, v, a, tau;
+
+          /// Find the sample at a given time.
+          bool find (value_type time, size_type& i) const;
+        };
+        typedef shared_ptr<const Cache> CachePtr_t;
+
+        struct Sample;
+
+        /// Future samples evaluated by one thread for the preview window.
+        struct PreviewBuffer {
+          /// Value of Preview::version when the settings were copied.
+          std::size_t version;
+          size_type size;
+          value_type dt;
+          std::vector<pinocchio::FrameIndex> frames;
+          /// Path of the samples of the buffer.
+          PathPtr_t path;
+          /// Circular buffer of samples, one per column: time,
+          /// configuration, velocity, pose of the root joint and pose of
+          /// each frame.
+          pinocchio::matrix_t samples;
+          /// Column of the first sample and number of valid samples.
+          size_type first, count;
+          /// Buffers to evaluate the future samples.
+          shared_ptr<Sample> sample;
+          PreviewBuffer () : version (0), size (0), dt (0), first (0),
+            count (0) {}
+        };
+
+        /// Frame published for a sample, copied from frames_ by \ref prepare.
+        struct FrameOutput {
+          pinocchio::FrameIndex index;
+          ComputationOption option;
+          ChannelIndex chQ, chV;
+        };
+
+        /// Center of mass published for a sample, copied from coms_ by
+        /// \ref prepare, and its value computed by \ref evaluate.
+        struct ComOutput {
+          CenterOfMassComputationPtr_t com;
+          ComputationOption option;
+          ChannelIndex chQ, chV;
+          vector3_t position, velocity;
+        };
+
+        /// Buffers used by one thread to evaluate the path.
+        struct Sample {
+          /// Index of the call to compute.
+          std::size_t tick;
+          value_type time;
+          Configuration_t q;
+          vector_t v;
+          /// Acceleration and torques, computed according to outputs.
+          vector_t a, tau;
+          /// Combination of SecondDerivative and Feedforward.
+          int outputs;
+          /// Time from which the deadline of the sample is computed.
+          value_type clock;
+          /// Factor applied to the velocity of the path, and its derivative
+          /// with respect to time.
+          value_type velocityScale, velocityScaleRate;
+          /// Precomputed samples, if any.
+          CachePtr_t cache;
+          /// Value of path_ when \ref path was copied.
+          PathPtr_t source;
+          /// Path evaluated by this thread: a copy of \ref source if it has
+          /// constraints, as their projection is not reentrant.
+          PathPtr_t path;
+          PathEvaluator evaluator;
+          /// Whether \ref evaluator computes q and v in one pass.
+          bool fused;
+          /// Forward kinematics computed by \ref evaluate.
+          Kinematics kinematics;
+          /// Kernel and its output, when kinematics is CompiledKinematics.
+          KinematicsKernelPtr_t kernel;
+          std::vector<value_type> targets;
+          /// Frames and centers of mass published at \ref tick, and the
+          /// value of topicsVersion_ when they were copied.
+          std::vector<FrameOutput> frames;
+          std::vector<ComOutput> coms;
+          std::size_t topicsVersion;
+          PreviewBuffer preview;
+          Sample () : tick (0), time (0), outputs (0), clock (0)
+                      , velocityScale (1), velocityScaleRate (0)
+                      , fused (true), kinematics (NoKinematics)
+                      , topicsVersion (0) {}
+
+          /// Output of \ref kernel for a target.
+          /// \pre the target is in the kernel.
+          const value_type* target (std::size_t id) const
+          {
+            return &targets[KinematicsKernel::targetSize
+              * (std::size_t) kernel->index (id)];
+          }
+        };
+
+        static const ChannelIndex noChannel = (ChannelIndex) -1;
+
         Discretization (const DevicePtr_t device)
           : device_ (device)
           , handle_ (NULL)
+          , nextTicket_ (0)
+          , nextPublished_ (0)
           , topicPrefix_ ("/hpp/target/")
-        {}
+          , hasFreeflyer_ (false)
+          , fusedEvaluation_ (true)
+          , splineResolution_ (0)
+          , splineTolerance_ (0)
+          , retiming_ (false)
+          , problemSolver_ (NULL)
+          , gridStart_ (0)
+          , gridLength_ (0)
+          , gridDt_ (0)
+          , gridSize_ (0)
+          , requested_ (false)
+          , lastRequestedTime_ (0)
+          , stamping_ (false)
+          , stampDelay_ (0)
+          , stampOriginSet_ (false)
+          , streaming_ (false)
+          , streamStop_ (false)
+          , streamReady_ (false)
+          , timeScale_ (1)
+          , timeScaleAcceleration_ (2)
+          , streamIndex_ (0)
+          , streamScale_ (1)
+          , streamPeriod_ (0)
+          , adaptiveLead_ (false)
+          , minLead_ (1)
+          , maxLead_ (0)
+          , streamLead_ (0)
+          , consumerDepth_ (-1)
+          , monitorStop_ (true)
+          , monitorHorizon_ (0)
+          , monitorStep_ (0)
+          , collisionStop_ (false)
+        {
+          qChannel_ = addChannel ("position", VectorChannel);
+          vChannel_ = addChannel ("velocity", VectorChannel);
+          aChannel_ = tauChannel_ = stampChannel_ = noChannel;
+          postureOutputs_ = 0;
+          cacheSamples_ = false;
+          nbFixedChannels_ = channels_.size();
+          topicsVersion_ = 0;
+        }
 
         void init (const DiscretizationWkPtr_t)
         {}
 
+        /// Get the current path, or throw if it is not set.
+        PathPtr_t currentPath ();
+
+        /// Compute the samples of the time grid if \ref cacheSamples is
+        /// enabled.
+        void fillCache ();
+
+        /// Compute the samples first, first + step, ... of a cache.
+        /// \param[out] error the error message, if any.
+        void fillCacheRange (PathPtr_t path, Cache* cache, size_type first,
+            size_type step, std::string* error) const;
+
+        /// Convert the path to an explicit spline if enabled and needed.
+        PathPtr_t explicitPath (const PathPtr_t& path);
+
+        /// Retime the path if enabled.
+        PathPtr_t retimedPath (const PathPtr_t& path);
+
+        /// Number of intervals of the grid of hpp::agimus::retime.
+        static const size_type retimingSegments = 1000;
+
+        /// Number of samples of a time grid.
+        static size_type gridSize (value_type length, value_type dt);
+
+        /// Time of a sample of the time grid.
+        /// \note must be called with \ref mutex_ locked.
+        value_type gridTime (size_type i) const;
+
+        /// Evaluate the path with the given device and buffers, and publish.
+        /// \param fromStream whether the call comes from the streaming thread.
+        void compute (value_type time, pinocchio::DeviceSync& device,
+            Sample& sample, bool fromStream);
+
+        /// Body of the streaming thread.
+        void stream (value_type period, size_type lead);
+
+        /// Publish the current lead of the streaming thread and get the
+        /// latest depth reported by \ref consumerQueueDepth.
+        /// \return false if no depth was reported since the previous call.
+        bool exchangeStreamLead (size_type lead, size_type& depth);
+
+        /// Time and velocity scale of the sample to stream at a tick.
+        /// \param[out] rate derivative of the velocity scale.
+        /// \return false if the streaming must stop.
+        bool nextStreamTime (size_type tick, value_type period,
+            value_type& time, value_type& scale, value_type& rate);
+
+        /// Path time needed to stop the stream, see \ref collisionMonitor.
+        /// \note must be called with \ref mutex_ locked.
+        value_type stoppingHorizon () const;
+
+        /// Body of the collision monitor thread.
+        void monitor ();
+
+        void stopCollisionMonitor ();
+
+        static bool active (size_type decimation, std::size_t tick)
+        {
+          return tick % (std::size_t) decimation == 0;
+        }
+
+        /// Forward kinematics needed by the channels written at a tick.
+        /// \note must be called with \ref mutex_ locked.
+        Kinematics kinematics (std::size_t tick) const;
+
+        /// Copy the settings used to compute the sample of a tick in the
+        /// thread data.
+        /// \return the forward kinematics needed by the tick.
+        /// \note must be called with \ref mutex_ locked.
+        Kinematics prepare (Sample& sample, std::size_t tick) const;
+
+        /// Evaluate the path, the forward kinematics and the centers of mass
+        /// of the sample in the given device.
+        void evaluate (const PathPtr_t& path, value_type time,
+            Kinematics kinematics, pinocchio::DeviceSync& device,
+            Sample& sample) const;
+
+        /// Publish a sample evaluated by \ref evaluate.
+        /// \note must be called with \ref mutex_ locked.
+        void publish (pinocchio::DeviceSync& device, const Sample& sample);
+
+        /// Size of the value written in the position channel.
+        size_type postureSize () const
+        {
+          return qView_.nbIndices() + (hasFreeflyer_ ? 6 : 0);
+        }
+
+        /// Size of the value written in the velocity channel.
+        size_type postureVelocitySize () const
+        {
+          return vView_.nbIndices() + (hasFreeflyer_ ? 6 : 0);
+        }
+
+        /// Compute the value written in the position channel.
+        void posture (pinocchio::DeviceSync& device, const Sample& sample,
+            vectorOut_t q) const;
+
+        /// Compute the value written in the velocity channel.
+        void postureVelocity (const Sample& sample, vectorOut_t v) const
+        {
+          postureTangent (sample.v, v);
+        }
+
+        /// Select the values of a tangent vector written in the channels with
+        /// the layout of the velocity channel.
+        void postureTangent (const vector_t& x, vectorOut_t out) const;
+
+        /// Fill the circular buffer of the preview window of a thread.
+        /// \note the evaluations overwrite the data of \c device.
+        void evaluatePreview (const PathPtr_t& path, value_type time,
+            pinocchio::DeviceSync& device, Sample& sample) const;
+
+        /// Fill a column of PreviewBuffer::samples.
+        void previewSample (pinocchio::DeviceSync& device,
+            const Sample& sample, const PreviewBuffer& buffer,
+            vectorOut_t column) const;
+
+        /// Write the preview window evaluated by \ref evaluatePreview.
+        /// \note must be called with \ref mutex_ locked.
+        void publishPreview (const Sample& sample);
+
+        /// Resize the buffers of \ref publishPreview.
+        /// \note must be called with \ref mutex_ locked.
+        void resizePreview ();
+
+        Sample& threadSample ();
+
+        /// Register a channel in all the sinks.
+        /// \note must be called with \ref mutex_ locked.
+        ChannelIndex addChannel (const std::string& name, ChannelType type);
+
+        /// Prefix of \ref buffer_ of size \c n.
+        /// The buffer only grows so that it is not reallocated at each
+        /// sample.
+        vectorOut_t buffer (size_type n)
+        {
+          if (buffer_.size() < n) buffer_.resize (n);
+          return buffer_.head (n);
+        }
+
+        /// Write a value in all the sinks.
+        void write (ChannelIndex index, vectorIn_t value)
+        {
+          for (std::size_t i = 0; i < sinks_.size(); ++i)
+            sinks_[i]->write (index, value);
+        }
+
         PathPtr_t path_;
         DevicePtr_t device_;
         ros::NodeHandle* handle_;
+        /// Protects the path, the publishers and the publication order.
         boost::mutex mutex_;
+        boost::condition_variable published_;
+        /// Publication order of the calls to compute.
+        std::size_t nextTicket_, nextPublished_;
 
-        Configuration_t q_;
-        vector_t v_;
+        boost::thread_specific_ptr<Sample> samples_;
 
         std::string topicPrefix_;
 
         Eigen::RowBlockIndices qView_, vView_;
 
-        ros::Publisher pubQ, pubV;
+        struct Channel {
+          std::string name;
+          ChannelType type;
+          Channel (const std::string& _name, ChannelType _type)
+            : name(_name), type(_type) {}
+        };
+        std::vector<Channel> channels_;
+        std::vector<OutputSinkPtr_t> sinks_;
+        RosSinkPtr_t rosSink_;
+        FileSinkPtr_t fileSink_;
+        /// Buffer used to build the values written in the sinks.
+        vector_t buffer_;
+
+        ChannelIndex qChannel_, vChannel_, stampChannel_;
+        /// Channels of \ref postureOutputs
+        ChannelIndex aChannel_, tauChannel_;
+        int postureOutputs_;
+        bool cacheSamples_;
+        CachePtr_t cache_;
+        /// Number of channels that are not removed by \ref resetTopics.
+        std::size_t nbFixedChannels_;
         struct COM {
+          std::string name;
           CenterOfMassComputationPtr_t com;
           ComputationOption option;
-          ros::Publisher pubQ, pubV;
-          COM (CenterOfMassComputationPtr_t _com, ComputationOption _option)
-            : com(_com), option(_option), pubQ(), pubV() {}
-          void compute(::hpp::pinocchio::DeviceData& d);
-          void initPublishers (const std::string& prefix, const std::string& name, ros::NodeHandle& nh);
+          size_type decimation;
+          ChannelIndex chQ, chV;
+          COM (const std::string& _name, CenterOfMassComputationPtr_t _com,
+              ComputationOption _option, size_type _decimation)
+            : name(_name), com(_com), option(_option), decimation(_decimation)
+            , chQ(noChannel), chV(noChannel) {}
+          void registerChannels (const std::string& name, Discretization& d);
         };
         std::vector<COM> coms_;
         struct FrameData {
+          std::string name;
           pinocchio::FrameIndex index;
           ComputationOption option;
-          ros::Publisher pubQ, pubV;
-          FrameData (pinocchio::FrameIndex _index, ComputationOption _option)
-            : index(_index), option(_option), pubQ(), pubV() {}
-          void initPublishers (const std::string& prefix, const std::string& name, ros::NodeHandle& nh);
+          size_type decimation;
+          ChannelIndex chQ, chV;
+          FrameData (const std::string& _name, pinocchio::FrameIndex _index,
+              ComputationOption _option, size_type _decimation)
+            : name(_name), index(_index), option(_option)
+            , decimation(_decimation), chQ(noChannel), chV(noChannel) {}
+          void registerChannels (const std::string& name, Discretization& d);
         };
         std::vector<FrameData> frames_;
+        /// Incremented by \ref resetTopics, which removes the channels.
+        std::size_t topicsVersion_;
+        /// \sa generatedKinematics
+        KinematicsKernelPtr_t kernel_;
+
+        struct Preview {
+          size_type size;
+          value_type dt;
+          std::vector<pinocchio::FrameIndex> frames;
+          ChannelIndex channel;
+          /// Incremented when the settings change, so that the threads
+          /// copy them in their PreviewBuffer.
+          std::size_t version;
+          /// Samples in increasing time order, one per row.
+          pinocchio::matrix_t window;
+          /// Buffers of the conversion to the layout of the channels.
+          Configuration_t q;
+          vector_t v, posture, tangent;
+          Preview () : size (0), dt (0), channel (noChannel), version (1) {}
+        };
+        Preview preview_;
         // whether the robot has a freeflyer joint in the Stack of Tasks
         bool hasFreeflyer_;
+        bool fusedEvaluation_;
+        /// Conversion to explicit splines, disabled if the resolution is 0.
+        value_type splineResolution_, splineTolerance_;
+        /// \sa retiming
+        bool retiming_;
+        vector_t retimingVelocity_, retimingAcceleration_, retimingJerk_;
+        vector_t retimedDurations_;
+        /// \sa queuePath
+        std::vector<PathPtr_t> queue_;
+        /// \sa problemSolver
+        core::ProblemSolverPtr_t problemSolver_;
+
+        /// Time grid
+        value_type gridStart_, gridLength_, gridDt_;
+        size_type gridSize_;
+
+        /// Whether compute was called since the path was set, and the
+        /// latest time passed to compute.
+        bool requested_;
+        value_type lastRequestedTime_;
+
+        bool stamping_;
+        value_type stampDelay_;
+        /// Whether the wall clock time corresponding to \ref stampTime_
+        /// is set.
+        bool stampOriginSet_;
+        value_type stampWallTime_, stampTime_;
+
+        /// Streaming thread
+        boost::thread streamThread_;
+        boost::condition_variable streamCond_;
+        bool streaming_, streamStop_, streamReady_;
+        std::string streamError_;
+        /// Target time scale and bound of its variation.
+        value_type timeScale_, timeScaleAcceleration_;
+        /// Position of the streaming thread on the time grid, as a
+        /// fractional sample index, and current time scale.
+        value_type streamIndex_, streamScale_;
+        /// Period of the latest stream or of \ref computeScaledSample, 0 if
+        /// none.
+        value_type streamPeriod_;
+        /// \sa adaptiveLead
+        bool adaptiveLead_;
+        size_type minLead_, maxLead_, streamLead_;
+        /// Latest depth reported by the consumer, -1 if none since it was
+        /// read by the streaming thread.
+        size_type consumerDepth_;
+
+        /// Collision monitor
+        boost::thread monitorThread_;
+        boost::condition_variable monitorCond_;
+        bool monitorStop_;
+        value_type monitorHorizon_, monitorStep_;
+        bool collisionStop_;
+        std::string collisionReport_;
     };
   } // namespace agimus
 } // namespace hpp
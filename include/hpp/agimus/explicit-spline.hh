@@ -0,0 +1,85 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef HPP_AGIMUS_EXPLICIT_SPLINE_HH
+#define HPP_AGIMUS_EXPLICIT_SPLINE_HH
+
+#include <hpp/pinocchio/device.hh>
+#include <hpp/core/fwd.hh>
+
+namespace hpp {
+  namespace agimus {
+    typedef pinocchio::value_type value_type;
+    typedef pinocchio::size_type size_type;
+    typedef pinocchio::DevicePtr_t DevicePtr_t;
+    typedef core::PathPtr_t PathPtr_t;
+
+    /// Whether the path, or one of its sub-paths, has constraints.
+    bool hasConstraints (const PathPtr_t& path);
+
+    /// Express the derivatives of a curve at \c q in the tangent space at
+    /// \c q0, on the Lie group of core::path::Spline.
+    ///
+    /// The curve is \f$ q \oplus (t v + \frac{t^2}{2} a) \f$, and the
+    /// derivatives at \f$ t = 0 \f$ of \f$ (q \oplus (t v + \frac{t^2}{2}
+    /// a)) \ominus q_0 \f$ are computed by central finite differences.
+    /// They are the derivatives that the parameters of a spline with base
+    /// \c q0 must have to pass through \c q with velocity \c v and
+    /// acceleration \c a.
+    /// \param[out] dv, da first and second derivatives.
+    void transport (const DevicePtr_t& device, pinocchio::ConfigurationIn_t q0,
+        pinocchio::ConfigurationIn_t q, pinocchio::vectorIn_t v,
+        pinocchio::vectorIn_t a, pinocchio::vectorOut_t dv,
+        pinocchio::vectorOut_t da);
+
+    /// Approximate a path by a piecewise cubic spline without constraints.
+    ///
+    /// The path is evaluated, and thus projected, once at each knot. The
+    /// spline interpolates the configuration and the velocity at the knots.
+    /// An interval is split in two as long as the distance between the
+    /// spline and the path at its middle is above \c tolerance, or the
+    /// spline does not satisfy the constraints of the path at its middle.
+    ///
+    /// \param resolution maximal duration between two knots.
+    /// \param tolerance maximal norm of the difference between the spline
+    ///        and the path at the middle of each interval. The constraints
+    ///        are checked with the error threshold of their projector.
+    /// \param nbThreads number of threads projecting the knots. Each thread
+    ///        uses its own copy of the path.
+    /// \return a core::PathVector of core::path::Spline. Its time range
+    ///         starts at 0.
+    /// \throw std::runtime_error if the path cannot be evaluated at a knot,
+    ///        or if the tolerance is not reached after 8 refinements of an
+    ///        interval.
+    PathPtr_t explicitSpline (const PathPtr_t& path, const DevicePtr_t& device,
+        value_type resolution, value_type tolerance, size_type nbThreads);
+  } // namespace agimus
+} // namespace hpp
+
+#endif // HPP_AGIMUS_EXPLICIT_SPLINE_HH
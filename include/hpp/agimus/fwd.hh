@@ -49,7 +49,12 @@ namespace agimus{
   typedef manipulation::ProblemSolverPtr_t ProblemSolverPtr_t;
   HPP_PREDEF_CLASS(PointCloud);
   typedef shared_ptr<PointCloud> PointCloudPtr_t;
-  typedef Eigen::Matrix<value_type, Eigen::Dynamic, 3> PointMatrix_t;
+  /// Matrix of points, one point per row.
+  /// Rows are contiguous so that points can be appended without copy.
+  template <typename Scalar> struct PointMatrix
+  {
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 3, Eigen::RowMajor> type;
+  };
 } // namespace agimus
 } // namespace hpp
 #endif // AGIMUS_HPP_FWD_HH
@@ -0,0 +1,247 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef HPP_AGIMUS_INTERPOLATION_HH
+#define HPP_AGIMUS_INTERPOLATION_HH
+
+#include <cmath>
+#include <deque>
+#include <utility>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+/// \file interpolation.hh
+/// Interpolation of the references published by Discretization.
+///
+/// This header only depends on Eigen so that controllers can include it
+/// without depending on HPP. It is meant to be used with time stamping
+/// enabled in Discretization: references can then be published at a lower
+/// rate than the control loop and interpolated on the controller side.
+///
+/// The layouts of the values are the ones of the channels of Discretization:
+/// \li posture: optionally the root joint (translation and roll-pitch-yaw
+///     angles as returned by \c eulerAngles(2,1,0)) followed by the
+///     vector joints,
+/// \li frame pose: translation followed by quaternion (x, y, z, w).
+
+namespace hpp {
+  namespace agimus {
+    namespace interpolation {
+      typedef double Scalar;
+      typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+      typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+      typedef Eigen::Matrix<Scalar, 3, 3> Matrix3;
+      typedef Eigen::Matrix<Scalar, 6, 1> Vector6;
+      typedef Eigen::Matrix<Scalar, 7, 1> Vector7;
+      typedef Eigen::Quaternion<Scalar> Quaternion;
+      typedef Eigen::AngleAxis<Scalar> AngleAxis;
+
+      namespace details {
+        inline Matrix3 skew (const Vector3& v)
+        {
+          Matrix3 S;
+          S <<     0, -v[2],  v[1],
+                v[2],     0, -v[0],
+               -v[1],  v[0],     0;
+          return S;
+        }
+
+        /// Left jacobian of SO(3) and its inverse.
+        inline Matrix3 leftJacobian (const Vector3& w)
+        {
+          const Scalar t = w.norm();
+          const Matrix3 W (skew(w));
+          if (t < 1e-6) return Matrix3::Identity() + .5*W;
+          const Scalar t2 = t*t;
+          return Matrix3::Identity() + (1 - std::cos(t)) / t2 * W
+            + (t - std::sin(t)) / (t2*t) * W * W;
+        }
+
+        inline Matrix3 leftJacobianInverse (const Vector3& w)
+        {
+          const Scalar t = w.norm();
+          const Matrix3 W (skew(w));
+          if (t < 1e-6) return Matrix3::Identity() - .5*W;
+          // (1 + cos t) / sin t = cot (t/2), which is also defined at
+          // t = pi, the largest angle returned by AngleAxis.
+          const Scalar t2 = t*t;
+          return Matrix3::Identity() - .5 * W
+            + (1/t2 - std::cos(t/2) / (2*t*std::sin(t/2))) * W * W;
+        }
+      } // namespace details
+
+      /// Logarithm of SE(3)
+      /// \return the twist (linear, angular) such that exp(twist) = (R, p)
+      inline Vector6 log6 (const Quaternion& R, const Vector3& p)
+      {
+        AngleAxis aa (R);
+        Vector3 w (aa.angle() * aa.axis());
+        Vector6 nu;
+        nu.head<3>() = details::leftJacobianInverse(w) * p;
+        nu.tail<3>() = w;
+        return nu;
+      }
+
+      /// Exponential of SE(3)
+      inline void exp6 (const Vector6& nu, Quaternion& R, Vector3& p)
+      {
+        const Vector3 w (nu.tail<3>());
+        const Scalar t = w.norm();
+        if (t < 1e-12) R.setIdentity();
+        else R = Quaternion (AngleAxis (t, w / t));
+        p = details::leftJacobian(w) * nu.head<3>();
+      }
+
+      /// Linear interpolation of vectors
+      /// \param u interpolation parameter in [0, 1]
+      template <typename Derived0, typename Derived1, typename DerivedOut>
+      inline void vector (const Eigen::MatrixBase<Derived0>& x0,
+          const Eigen::MatrixBase<Derived1>& x1, Scalar u,
+          const Eigen::MatrixBase<DerivedOut>& x)
+      {
+        const_cast<Eigen::MatrixBase<DerivedOut>&>(x) = x0 + u * (x1 - x0);
+      }
+
+      /// Cubic Hermite interpolation of vectors using the velocities.
+      /// \param dt duration between the two samples
+      /// \param u interpolation parameter in [0, 1]
+      /// \param[out] x value at u
+      /// \param[out] v derivative with respect to time at u
+      inline void hermite (const Vector& x0, const Vector& v0,
+          const Vector& x1, const Vector& v1, Scalar dt, Scalar u,
+          Vector& x, Vector& v)
+      {
+        const Scalar u2 = u*u, u3 = u2*u;
+        const Scalar h00 = 2*u3 - 3*u2 + 1, h10 = u3 - 2*u2 + u,
+                     h01 = -2*u3 + 3*u2,    h11 = u3 - u2;
+        const Scalar d00 = 6*u2 - 6*u, d10 = 3*u2 - 4*u + 1,
+                     d01 = -6*u2 + 6*u, d11 = 3*u2 - 2*u;
+        x = h00 * x0 + h10 * dt * v0 + h01 * x1 + h11 * dt * v1;
+        v = (d00 * x0 + d01 * x1) / dt + d10 * v0 + d11 * v1;
+      }
+
+      /// Interpolation on SE(3) along the geodesic.
+      /// \param M0, M1 translation followed by quaternion (x, y, z, w).
+      /// \param u interpolation parameter in [0, 1]
+      /// \param[out] M interpolated pose, with the same layout.
+      inline void se3 (const Vector7& M0, const Vector7& M1, Scalar u,
+          Vector7& M)
+      {
+        const Quaternion R0 (M0.tail<4>()), R1 (M1.tail<4>());
+        const Vector3 p0 (M0.head<3>()), p1 (M1.head<3>());
+        // Relative motion expressed in the frame of M0.
+        const Quaternion R01 (R0.conjugate() * R1);
+        const Vector3 p01 (R0.conjugate() * (p1 - p0));
+        Quaternion Ru; Vector3 pu;
+        exp6 (u * log6 (R01, p01), Ru, pu);
+        M.head<3>() = p0 + R0 * pu;
+        M.tail<4>() = (R0 * Ru).normalized().coeffs();
+      }
+
+      /// Interpolation of a posture
+      /// \param hasFreeflyer whether the 6 first values are the root joint
+      ///        translation and roll-pitch-yaw angles.
+      /// The root joint is interpolated on SE(3), the other values linearly.
+      inline void posture (const Vector& q0, const Vector& q1, Scalar u,
+          bool hasFreeflyer, Vector& q)
+      {
+        q.resize (q0.size());
+        const Eigen::Index n = (hasFreeflyer ? 6 : 0);
+        vector (q0.tail(q0.size()-n), q1.tail(q1.size()-n), u,
+            q.tail(q.size()-n));
+        if (!hasFreeflyer) return;
+
+        Vector7 M0, M1, M;
+        M0.head<3>() = q0.head<3>();
+        M1.head<3>() = q1.head<3>();
+        M0.tail<4>() = Quaternion (
+            AngleAxis (q0[3], Vector3::UnitZ()) *
+            AngleAxis (q0[4], Vector3::UnitY()) *
+            AngleAxis (q0[5], Vector3::UnitX())).coeffs();
+        M1.tail<4>() = Quaternion (
+            AngleAxis (q1[3], Vector3::UnitZ()) *
+            AngleAxis (q1[4], Vector3::UnitY()) *
+            AngleAxis (q1[5], Vector3::UnitX())).coeffs();
+        se3 (M0, M1, u, M);
+        q.head<3>() = M.head<3>();
+        q.segment<3>(3) = Quaternion (M.tail<4>()).toRotationMatrix()
+          .eulerAngles (2, 1, 0);
+      }
+
+      /// Buffer of time stamped samples of one channel.
+      ///
+      /// Samples must be pushed in increasing time order. Samples older than
+      /// the one before the last requested time are discarded.
+      template <typename Value>
+      class Buffer
+      {
+        public:
+          typedef std::pair<Scalar, Value> Sample;
+
+          void push (Scalar time, const Value& value)
+          {
+            samples_.push_back (Sample (time, value));
+          }
+
+          bool empty () const { return samples_.empty(); }
+
+          void clear () { samples_.clear(); }
+
+          /// Find the samples surrounding \c time.
+          /// \param[out] s0, s1 the samples such that
+          ///             s0.first <= time <= s1.first.
+          /// \param[out] u interpolation parameter.
+          /// \return false if \c time is not in the range of the buffer. In
+          ///         this case, s0 and s1 are both set to the closest sample.
+          bool bracket (Scalar time, const Sample*& s0, const Sample*& s1,
+              Scalar& u)
+          {
+            if (samples_.empty()) return false;
+            // Drop samples that are not needed any more.
+            while (samples_.size() > 1 && samples_[1].first <= time)
+              samples_.pop_front();
+            s0 = &samples_.front();
+            u = 0;
+            if (time < s0->first || samples_.size() == 1) {
+              s1 = s0;
+              return time == s0->first;
+            }
+            s1 = &samples_[1];
+            u = (time - s0->first) / (s1->first - s0->first);
+            return true;
+          }
+
+        private:
+          std::deque<Sample> samples_;
+      }; // class Buffer
+    } // namespace interpolation
+  } // namespace agimus
+} // namespace hpp
+
+#endif // HPP_AGIMUS_INTERPOLATION_HH
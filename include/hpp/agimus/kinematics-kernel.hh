@@ -0,0 +1,138 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef HPP_AGIMUS_KINEMATICS_KERNEL_HH
+#define HPP_AGIMUS_KINEMATICS_KERNEL_HH
+
+#include <string>
+#include <vector>
+
+#include <hpp/util/pointer.hh>
+#include <hpp/pinocchio/fwd.hh>
+#include <pinocchio/spatial/se3.hpp>
+
+namespace hpp {
+  namespace agimus {
+    typedef pinocchio::value_type value_type;
+
+    HPP_PREDEF_CLASS(KinematicsKernel);
+    typedef shared_ptr<const KinematicsKernel> KinematicsKernelPtr_t;
+
+    /// Forward kinematics generated and compiled for a given robot.
+    ///
+    /// The kinematic tree is unrolled into straight-line C++ code computing
+    /// the placement and the velocity of a set of targets, with the
+    /// constants of the model folded in. The code is compiled into a shared
+    /// library, cached on disk under a hash of the code, of the compiler and
+    /// of its flags, and loaded with dlopen.
+    ///
+    /// The supported joints are the revolute and prismatic joints (aligned
+    /// with an axis or not), the unbounded revolute joints and the
+    /// free-flyer.
+    ///
+    /// The compiler is taken from environment variable HPP_AGIMUS_CXX, CXX
+    /// or defaults to c++. The cache directory is taken from
+    /// HPP_AGIMUS_KERNEL_CACHE or defaults to $XDG_CACHE_HOME/hpp-agimus or
+    /// to .cache/hpp-agimus in the home directory of the user. It is
+    /// created with mode 0700 and must be owned by the user and not be
+    /// writable by others, since the libraries it contains are loaded.
+    class KinematicsKernel
+    {
+      public:
+        /// A placement attached to a joint.
+        struct Target {
+          pinocchio::JointIndex joint;
+          pinocchio::SE3 placement;
+          /// Identifier used by \ref index.
+          std::size_t id;
+          Target (pinocchio::JointIndex _joint,
+              const pinocchio::SE3& _placement, std::size_t _id)
+            : joint (_joint), placement (_placement), id (_id) {}
+        };
+
+        /// Number of values computed per target: translation, quaternion
+        /// (x, y, z, w), linear and angular velocity expressed in the target
+        /// frame (as pinocchio::getFrameVelocity).
+        static const std::size_t targetSize = 13;
+
+        /// Generate, compile and load the kernel.
+        /// \return NULL if the model contains a joint that is not supported.
+        /// \throw std::runtime_error if the code cannot be compiled or
+        ///        loaded, or if its results differ from pinocchio.
+        static KinematicsKernelPtr_t create (const pinocchio::Model& model,
+            const std::vector<Target>& targets);
+
+        /// Generate the code.
+        /// \return false if the model contains a joint that is not
+        ///         supported.
+        static bool generate (const pinocchio::Model& model,
+            const std::vector<Target>& targets, std::string& code);
+
+        /// Compute the targets.
+        /// \param q, v configuration and velocity of the model.
+        /// \param out array of size targetSize times the number of targets.
+        void compute (const value_type* q, const value_type* v,
+            value_type* out) const
+        {
+          function_ (q, v, out);
+        }
+
+        /// Index of the target with the given identifier, -1 if none.
+        int index (std::size_t id) const
+        {
+          for (std::size_t i = 0; i < targets_.size(); ++i)
+            if (targets_[i].id == id) return (int) i;
+          return -1;
+        }
+
+        std::size_t outputSize () const
+        {
+          return targetSize * targets_.size();
+        }
+
+        ~KinematicsKernel ();
+
+      private:
+        typedef void (*Function_t) (const value_type*, const value_type*,
+            value_type*);
+
+        KinematicsKernel (const std::vector<Target>& targets)
+          : targets_ (targets), library_ (NULL), function_ (NULL) {}
+
+        /// Compare the results with pinocchio.
+        void check (const pinocchio::Model& model) const;
+
+        std::vector<Target> targets_;
+        void* library_;
+        Function_t function_;
+    }; // class KinematicsKernel
+  } // namespace agimus
+} // namespace hpp
+
+#endif // HPP_AGIMUS_KINEMATICS_KERNEL_HH
@@ -0,0 +1,273 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef HPP_AGIMUS_OUTPUT_SINK_HH
+#define HPP_AGIMUS_OUTPUT_SINK_HH
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <hpp/util/pointer.hh>
+#include <hpp/pinocchio/fwd.hh>
+
+#include <ros/node_handle.h>
+#include <ros/publisher.h>
+
+namespace hpp {
+  namespace agimus {
+    typedef pinocchio::value_type value_type;
+    typedef pinocchio::vector_t vector_t;
+    typedef pinocchio::vectorIn_t vectorIn_t;
+    typedef pinocchio::matrix_t matrix_t;
+    typedef pinocchio::matrixIn_t matrixIn_t;
+
+    HPP_PREDEF_CLASS(OutputSink);
+    typedef shared_ptr<OutputSink> OutputSinkPtr_t;
+    HPP_PREDEF_CLASS(RosSink);
+    typedef shared_ptr<RosSink> RosSinkPtr_t;
+    HPP_PREDEF_CLASS(MemorySink);
+    typedef shared_ptr<MemorySink> MemorySinkPtr_t;
+    HPP_PREDEF_CLASS(FileSink);
+    typedef shared_ptr<FileSink> FileSinkPtr_t;
+
+    /// Index of a channel, chosen by the caller of OutputSink::addChannel.
+    typedef std::size_t ChannelIndex;
+
+    /// Type of the values written in a channel.
+    enum ChannelType
+    {
+      /// Vector of any size.
+      VectorChannel,
+      /// Vector of size 3.
+      Vector3Channel,
+      /// Vector of size 7: translation followed by quaternion (x, y, z, w).
+      TransformChannel,
+      /// Matrix of any size, written with OutputSink::writeMatrix.
+      MatrixChannel
+    };
+
+    /// Destination of the references computed by Discretization.
+    ///
+    /// Channels are registered once. Then, for each sample,
+    /// \li \ref beginTick is called,
+    /// \li \ref write (or \ref writeMatrix for channels of type
+    ///     MatrixChannel) is called for each channel that has a value,
+    /// \li \ref commitTick is called if no error occured.
+    class OutputSink
+    {
+      public:
+        /// Register a channel
+        /// \param index index used in \ref write. Indices are not necessarily
+        ///        contiguous.
+        /// \param name relative name of the channel, e.g. "position" or
+        ///        "op_frame/gripper".
+        virtual void addChannel (ChannelIndex index, const std::string& name,
+            ChannelType type) = 0;
+
+        /// Remove all the channels.
+        virtual void resetChannels () = 0;
+
+        /// Start a new sample.
+        /// \param tick index of the sample, increasing from one sample to
+        ///        the next one.
+        /// \param time time of the sample along the path.
+        virtual void beginTick (std::size_t tick, value_type time) = 0;
+
+        virtual void write (ChannelIndex index, vectorIn_t value) = 0;
+
+        virtual void writeMatrix (ChannelIndex index, matrixIn_t value) = 0;
+
+        /// Finish the current sample.
+        virtual void commitTick () = 0;
+
+        virtual ~OutputSink () {}
+    }; // class OutputSink
+
+    /// Publish each channel on a ROS topic.
+    ///
+    /// Values written during a tick are published on \ref commitTick.
+    class RosSink : public OutputSink
+    {
+      public:
+        static RosSinkPtr_t create (ros::NodeHandle& handle,
+            const std::string& prefix)
+        {
+          return RosSinkPtr_t (new RosSink (handle, prefix));
+        }
+
+        void addChannel (ChannelIndex index, const std::string& name,
+            ChannelType type);
+
+        void resetChannels ();
+
+        void beginTick (std::size_t tick, value_type time);
+
+        void write (ChannelIndex index, vectorIn_t value);
+
+        void writeMatrix (ChannelIndex index, matrixIn_t value);
+
+        void commitTick ();
+
+        /// Shutdown all the publishers.
+        ~RosSink ();
+
+      private:
+        RosSink (ros::NodeHandle& handle, const std::string& prefix)
+          : handle_ (handle), prefix_ (prefix)
+        {}
+
+        struct Channel {
+          ChannelType type;
+          ros::Publisher pub;
+          vector_t value;
+          matrix_t matrix;
+          bool written;
+          Channel () : written (false) {}
+        };
+
+        ros::NodeHandle& handle_;
+        std::string prefix_;
+        std::vector<Channel> channels_;
+    }; // class RosSink
+
+    /// Store all the values in memory.
+    ///
+    /// This is meant for tests and benchmarks without a ROS master.
+    class MemorySink : public OutputSink
+    {
+      public:
+        static MemorySinkPtr_t create ()
+        {
+          return MemorySinkPtr_t (new MemorySink);
+        }
+
+        void addChannel (ChannelIndex index, const std::string& name,
+            ChannelType type);
+
+        void resetChannels ();
+
+        void beginTick (std::size_t tick, value_type time);
+
+        void write (ChannelIndex index, vectorIn_t value);
+
+        void writeMatrix (ChannelIndex index, matrixIn_t value);
+
+        void commitTick ();
+
+        /// Remove the stored values and keep the channels.
+        void clear ();
+
+        /// Times of the committed samples.
+        const std::vector<value_type>& times () const
+        {
+          return times_;
+        }
+
+        /// Indices of the committed samples.
+        const std::vector<std::size_t>& ticks () const
+        {
+          return ticks_;
+        }
+
+        /// Index of the sample of each value of a channel.
+        /// \throw std::invalid_argument if the channel does not exist.
+        const std::vector<std::size_t>& valueTicks (const std::string& name)
+          const;
+
+        /// Values written in a channel, one per committed tick in which the
+        /// channel was written.
+        /// Matrices are stored row after row.
+        /// \throw std::invalid_argument if the channel does not exist.
+        const std::vector<vector_t>& values (const std::string& name) const;
+
+      private:
+        MemorySink () : tick_ (0), time_ (0) {}
+
+        struct Channel {
+          std::string name;
+          std::vector<vector_t> values;
+          std::vector<std::size_t> ticks;
+          std::size_t nbCommitted;
+          Channel () : nbCommitted (0) {}
+        };
+
+        const Channel& channel (const std::string& name) const;
+
+        std::size_t tick_;
+        value_type time_;
+        std::vector<std::size_t> ticks_;
+        std::vector<value_type> times_;
+        std::vector<Channel> channels_;
+    }; // class MemorySink
+
+    /// Record the values in a text file.
+    ///
+    /// Each channel is declared in the file by a line
+    /// \code
+    /// # <index> <name> <type>
+    /// \endcode
+    /// and each value by a line
+    /// \code
+    /// <tick> <time> <index> <value_1> ... <value_n>
+    /// \endcode
+    /// Matrices are written with one line per row.
+    /// The values of a tick are written only when the tick is committed.
+    class FileSink : public OutputSink
+    {
+      public:
+        /// \throw std::runtime_error if the file cannot be opened.
+        static FileSinkPtr_t create (const std::string& filename);
+
+        void addChannel (ChannelIndex index, const std::string& name,
+            ChannelType type);
+
+        void resetChannels ();
+
+        void beginTick (std::size_t tick, value_type time);
+
+        void write (ChannelIndex index, vectorIn_t value);
+
+        void writeMatrix (ChannelIndex index, matrixIn_t value);
+
+        void commitTick ();
+
+      private:
+        FileSink () : tickIndex_ (0), time_ (0) {}
+
+        std::ofstream file_;
+        /// Values of the current tick, written to the file on commit.
+        std::ostringstream tick_;
+        std::size_t tickIndex_;
+        value_type time_;
+    }; // class FileSink
+  } // namespace agimus
+} // namespace hpp
+
+#endif // HPP_AGIMUS_OUTPUT_SINK_HH
@@ -0,0 +1,123 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef HPP_AGIMUS_PATH_EVALUATOR_HH
+#define HPP_AGIMUS_PATH_EVALUATOR_HH
+
+#include <vector>
+
+#include <hpp/util/pointer.hh>
+#include <hpp/pinocchio/device.hh>
+#include <hpp/core/fwd.hh>
+#include <hpp/core/interpolated-path.hh>
+
+namespace hpp {
+  namespace agimus {
+    typedef pinocchio::value_type value_type;
+    typedef pinocchio::Configuration_t Configuration_t;
+    typedef pinocchio::ConfigurationOut_t ConfigurationOut_t;
+    typedef pinocchio::vector_t vector_t;
+    typedef pinocchio::vectorOut_t vectorOut_t;
+    typedef pinocchio::DevicePtr_t DevicePtr_t;
+    typedef core::PathPtr_t PathPtr_t;
+
+    /// Evaluate a path and its velocity in one pass.
+    ///
+    /// Calling core::Path::eval and then core::Path::derivative locates the
+    /// sub-path of a core::PathVector twice and computes the interpolation
+    /// twice. This class flattens the path once, looks the sub-path up from
+    /// the one of the previous call, and computes the configuration and the
+    /// velocity together for the sub-paths that allow it:
+    /// \li core::StraightPath: the velocity is constant and cached,
+    /// \li core::InterpolatedPath: the difference between the surrounding
+    ///     interpolation points gives both the velocity and the
+    ///     configuration.
+    ///
+    /// Sub-paths with constraints or with a time parameterization, and
+    /// other path types, fall back to eval and derivative.
+    /// An instance must not be used by several threads concurrently.
+    class PathEvaluator
+    {
+      public:
+        PathEvaluator () : fused_ (true), rank_ (0), s_ (0) {}
+
+        /// Set the path to evaluate.
+        /// Nothing is done if the arguments did not change since the last
+        /// call, so that this can be called before each evaluation.
+        /// \param fused when false, only eval and derivative are used.
+        ///        This is meant for benchmarks.
+        void path (const PathPtr_t& path, const DevicePtr_t& device,
+            bool fused);
+
+        /// Compute the configuration and the velocity at the given time.
+        /// \return false if the configuration could not be computed, for
+        ///         instance if a projection failed.
+        bool operator() (value_type time, ConfigurationOut_t q,
+            vectorOut_t v);
+
+        /// Compute the acceleration at the time of the last call to
+        /// operator().
+        /// It is zero on StraightPath and InterpolatedPath.
+        void acceleration (vectorOut_t a);
+
+      private:
+        enum Kind {
+          Generic,
+          Straight,
+          Interpolated
+        };
+
+        struct Leaf {
+          PathPtr_t path;
+          Kind kind;
+          /// Time of the beginning of the sub-path along the whole path.
+          value_type start;
+          /// For Straight, initial configuration and constant velocity.
+          Configuration_t initial;
+          vector_t velocity;
+          /// For Interpolated.
+          core::InterpolatedPathPtr_t interpolated;
+        };
+
+        void addLeaf (const PathPtr_t& path, value_type start);
+
+        PathPtr_t path_;
+        DevicePtr_t device_;
+        bool fused_;
+        std::vector<Leaf> leaves_;
+        /// Sub-path and local time of the last evaluation.
+        std::size_t rank_;
+        value_type s_;
+        /// Displacement from the initial configuration of a sub-path.
+        vector_t dq_;
+    }; // class PathEvaluator
+  } // namespace agimus
+} // namespace hpp
+
+#endif // HPP_AGIMUS_PATH_EVALUATOR_HH
@@ -30,21 +30,84 @@
 #ifndef HPP_AGIMUS_POINT_CLOUD_HH
 #define HPP_AGIMUS_POINT_CLOUD_HH
 
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <ros/node_handle.h>
 #include <sensor_msgs/PointCloud2.h>
 
+#include <hpp/fcl/BV/AABB.h>
+
 #include <hpp/util/pointer.hh>
 #include <hpp/agimus/fwd.hh>
 
+namespace octomap {
+  class OcTree;
+} // namespace octomap
+
 namespace hpp {
   namespace agimus {
+    /// Keep one point per voxel of a regular grid.
+    ///
+    /// The voxels are the cubes \f$ [k_x s, (k_x+1) s) \times [k_y s,
+    /// (k_y+1) s) \times [k_z s, (k_z+1) s) \f$, as the leaves of an octree
+    /// of resolution \f$ s \f$. The first point of each voxel is kept and
+    /// the order of the points is preserved.
+    /// \param points the points, one per row, filtered in place.
+    /// \param size size \f$ s \f$ of the voxels.
+    /// \return the number of points kept.
+    template <typename Scalar>
+    size_type voxelGridFilter(typename PointMatrix<Scalar>::type& points,
+                              value_type size);
+
+    /// Whether two objects may collide, for a configuration within the
+    /// bounds of the joints.
+    ///
+    /// The objects are expressed in the frame of their closest common
+    /// ancestor joint. An object held by this joint is bounded by its box.
+    /// Otherwise, it is bounded by the sphere containing all the positions
+    /// of the box. The sphere is computed from the distances between the
+    /// joints of the chain and from the bounds of their translations. It is
+    /// infinite if a translation is not bounded.
+    /// \param joint1 joint holding the first object,
+    /// \param box1 bounding box of the first object in the frame of joint1,
+    /// \param joint2 joint holding the second object,
+    /// \param box2 bounding box of the second object in the frame of joint2.
+    /// \return false if the objects can never collide.
+    bool mayCollide(const pinocchio::Model& model,
+                    JointIndex joint1, const hpp::fcl::AABB& box1,
+                    JointIndex joint2, const hpp::fcl::AABB& box2);
+
+    /// Geometries of a robot to pair with an octree.
+    ///
+    /// A geometry matches a name if its name starts with it. The octree is
+    /// paired with the geometries that match a name of \c allow (all if
+    /// \c allow is empty) and no name of \c deny. The geometries attached
+    /// to the joint of the octree, including when both are fixed in the
+    /// world, are never paired. Neither are the geometries that cannot
+    /// reach the occupied cells of the octree, whatever the configuration
+    /// within the bounds of the joints (see \ref mayCollide).
+    /// \param octreeGeomId index of the geometry of the octree,
+    /// \param octree octree of this geometry, that may replace the current
+    ///        one.
+    /// \return the indices of the geometries in increasing order, none if
+    ///         the octree is empty.
+    std::vector<GeomIndex> collisionGeometries
+    (const pinocchio::Model& model, const pinocchio::GeomModel& geomModel,
+     GeomIndex octreeGeomId, const hpp::fcl::OcTree& octree,
+     const std::vector<std::string>& allow,
+     const std::vector<std::string>& deny);
+
     class PointCloud
     {
     public:
       EIGEN_MAKE_ALIGNED_OPERATOR_NEW
       typedef hpp::fcl::OcTreePtr_t OcTreePtr_t;
+      /// Scalar type of the stored points, the one of the sensors.
+      typedef float PointScalar;
+      typedef PointMatrix<PointScalar>::type Points_t;
       static PointCloudPtr_t create (const ProblemSolverPtr_t& ps)
       {
 	PointCloudPtr_t ptr (new PointCloud(ps));
@@ -67,6 +130,10 @@ namespace hpp {
       ///        sensor frame.
       /// \param timeOut time after which the function returns error if no data
       ///        has been published (in seconds).
+      /// \param newPointCloud whether the points of the previous views are
+      ///        discarded. Otherwise, only the new points are inserted in the
+      ///        octree of the previous views, if it has the same frame and
+      ///        resolution.
       bool buildPointCloud(const std::string& octreeFrame,
 			 const std::string& topic,
 			 const std::string& sensorFrame,
@@ -80,10 +147,46 @@ namespace hpp {
       /// Set bounds on distance of points to sensor
       /// Points at a distance outside this interval are ignored.
       void setDistanceBounds(value_type min, value_type max);
+      /// Set the size of the voxels used to downsample the point cloud
+      /// before building the octree.
+      /// \param size 0 to use the resolution of the octree, a negative
+      ///        value to disable the downsampling.
+      /// \sa voxelGridFilter
+      void setVoxelSize(value_type size);
+      /// Set the number of threads decoding and filtering the point clouds.
+      /// Defaults to the number of cores. The threads are kept from one
+      /// point cloud to the next one.
+      /// The points are the same whatever the number of threads.
+      void setNumberOfThreads(size_type n);
+      inline void setNumberOfThreads(int n)
+      {
+        setNumberOfThreads((size_type)n);
+      }
       /// Set whether to display octree in gepetto-viewer
       void setDisplay(bool flag);
+      /// Select the geometries tested for collision with the octrees.
+      ///
+      /// A geometry matches a name if its name starts with it. The octree
+      /// is paired with the geometries that match a name of \c allow (all
+      /// if \c allow is empty) and no name of \c deny. Geometries attached
+      /// to the joint of the octree, including when both are fixed in the
+      /// world, are never paired. Neither are the geometries that cannot
+      /// reach the occupied cells of the octree, whatever the configuration
+      /// within the bounds of the joints.
+      /// \sa hpp::agimus::collisionGeometries, mayCollide
+      /// Taken into account by the next call to \ref buildPointCloud.
+      void setCollisionFilter(const std::vector<std::string>& allow,
+                              const std::vector<std::string>& deny);
       /// Callback to the point cloud topic
+      /// \sa filterPoints
       void pointCloudCb(const sensor_msgs::PointCloud2ConstPtr& data);
+      /// Decode, filter and express the points of a point cloud in the link
+      /// holding the octree, in a single pass over the message, and keep
+      /// one point per voxel.
+      /// \param data the point cloud, with fields x, y and z first.
+      /// \retval points the points inserted in the octree, one per row.
+      void filterPoints(const sensor_msgs::PointCloud2& data,
+                        Points_t& points);
       /// Set three points belonging to the object plan, in the object frame
       /// The (oriented) normal will be computed as $AC \times AB$ and
       /// all points behind the plan will be filtered out.
@@ -123,28 +226,54 @@ namespace hpp {
       PointCloud(const ProblemSolverPtr_t& ps);
       void init (const PointCloudWkPtr_t)
       {}
-      /// Express point cloud in octreeFrame
-      void movePointCloud(const std::string& octreeFrame,
-			  const std::string& sensorFrame,
-			  const vector_t& configuration);
-      /// Test if a point is in the wanted range
-      bool filterPoint(uint32_t pointcloud_id, uint32_t row_id);
+      /// Compute the pose of the sensor in the link holding the octree and
+      /// the object plan in the sensor frame, for the given configuration.
+      void computeSensorPose(const std::string& octreeFrame,
+                             const std::string& sensorFrame,
+                             const vector_t& configuration);
+      /// Size of the voxels of the grid, non positive if disabled.
+      value_type voxelGridSize() const;
 
+      /// Geometries to pair with an octree, with the filter of
+      /// \ref setCollisionFilter.
+      std::vector<GeomIndex> collisionGeometries
+      (const OcTreePtr_t& octree, GeomIndex octreeGeomId) const;
       void attachOctreeToRobot
       (const OcTreePtr_t& octree, const std::string& octreeFrame);
       bool displayOctree(const OcTreePtr_t& octree,
 			 const std::string& octreeFrame);
       bool undisplayOctree(const std::string& octreeFrame);
+      /// Run the tasks, the first one in the calling thread and the other
+      /// ones in the pool, and wait for their completion.
+      /// \param tasks at most nbThreads_ tasks.
+      void runTasks(const std::vector<boost::function<void()> >& tasks);
+      /// Loop of the thread of index \c index of the pool.
+      /// \param generation number of the last batch of tasks.
+      void poolThread(std::size_t index, size_type generation);
+      /// Stop and join the threads of the pool.
+      void stopPool();
       ProblemSolverPtr_t problemSolver_;
       bool waitingForData_;
       boost::mutex mutex_;
       ros::NodeHandle* handle_;
 
-      // Vector of the different point clouds measured
-      std::vector<PointMatrix_t> pointsInSensorFrame_;
-      PointMatrix_t pointsInLinkFrame_;
+      // Points of the latest point cloud, in the link holding the octree
+      Points_t pointsInLinkFrame_;
+      // Octree of the points of the views accumulated in octreeFrame_,
+      // shared with the geometry of the robot: modified while holding
+      // Discretization::geometryMutex
+      fcl::shared_ptr<octomap::OcTree> octomap_;
+      // Pose of the sensor in the link holding the octree
+      Transform3f linkMsensor_;
+      // Point in the object plan and normal, in the sensor frame
+      vector3_t planePoint_, planeNormal_;
       value_type minDistance_, maxDistance_;
+      value_type voxelSize_;
+      // Resolution of the octree being built
+      value_type resolution_;
+      size_type nbThreads_;
       bool display_;
+      std::vector<std::string> collisionAllow_, collisionDeny_;
       bool filterBehindPlan_;
       value_type objectPlanMargin_;
       // Point in the object plan, expressed in the object frame
@@ -154,6 +283,15 @@ namespace hpp {
       std::string octreeFrame_;
       std::string sensorFrame_;
       bool newPointCloud_;
+      // Threads of the pool, the thread calling runTasks being the first one
+      std::vector<shared_ptr<boost::thread> > pool_;
+      boost::mutex poolMutex_;
+      boost::condition_variable poolWork_, poolDone_;
+      // Tasks of the current batch, its number and the number of its tasks
+      // still running in the pool
+      std::vector<boost::function<void()> > tasks_;
+      size_type poolGeneration_, poolPending_;
+      bool poolStop_;
 
     }; // class PointCloud
   } // namespace agimus
@@ -0,0 +1,81 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef HPP_AGIMUS_RETIMING_HH
+#define HPP_AGIMUS_RETIMING_HH
+
+#include <hpp/pinocchio/device.hh>
+#include <hpp/core/fwd.hh>
+
+namespace hpp {
+  namespace agimus {
+    typedef pinocchio::value_type value_type;
+    typedef pinocchio::size_type size_type;
+    typedef pinocchio::vector_t vector_t;
+    typedef pinocchio::DevicePtr_t DevicePtr_t;
+    typedef core::PathPtr_t PathPtr_t;
+
+    /// Time optimal retiming of a path under joint limits.
+    ///
+    /// The time law along the geometric path is computed by reachability
+    /// analysis (TOPP-RA, Pham and Pham, 2018) on a grid of \c nbSegments
+    /// intervals of the path parameter: a backward pass computes the
+    /// controllable sets of \f$ \dot{s}^2 \f$ at the grid points and a
+    /// forward pass takes the largest admissible path acceleration. The
+    /// path starts and ends at rest.
+    ///
+    /// TOPP-RA only handles velocity and acceleration limits. To reduce the
+    /// jerk, the time law is smoothed by a moving average of width
+    /// \f$ 2 \max_j a_j / j_j \f$, which spreads each switch of the path
+    /// acceleration over the time needed to ramp the acceleration of the
+    /// joints at their jerk limit. This increases the duration by this
+    /// width.
+    ///
+    /// Neither the smoothing nor the grid guarantee the limits, so the
+    /// velocity, the acceleration and the jerk of the joints are then
+    /// evaluated along the final time law, at 8 times per interval of the
+    /// grid, and the time law is uniformly slowed down so that they all
+    /// hold at these times.
+    ///
+    /// \param velocity, acceleration limits of the joints, of the size of
+    ///        the velocity of the robot. Non positive values are ignored.
+    /// \param jerk jerk limits, of the same size or empty. Non positive
+    ///        values are ignored.
+    /// \return a core::PathVector containing \c path, with a time
+    ///         parameterization. Its time range starts at 0.
+    /// \throw std::invalid_argument if the size of the limits is wrong.
+    /// \throw std::runtime_error if the path cannot be followed within the
+    ///        limits.
+    PathPtr_t retime (const PathPtr_t& path, const DevicePtr_t& device,
+        const vector_t& velocity, const vector_t& acceleration,
+        const vector_t& jerk, size_type nbSegments);
+  } // namespace agimus
+} // namespace hpp
+
+#endif // HPP_AGIMUS_RETIMING_HH
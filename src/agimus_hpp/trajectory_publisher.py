@@ -36,7 +36,7 @@ import agimus_hpp.ros_tools as ros_tools
 from .tools import *
 from dynamic_graph_bridge_msgs.msg import Vector
 from geometry_msgs.msg import Vector3, Pose
-from std_msgs.msg import UInt32, Empty
+from std_msgs.msg import UInt32, Empty, Float64
 import std_srvs.srv
 
 from agimus_hpp.plugin.client import Client, Discretization
@@ -58,7 +58,12 @@ class HppOutputQueue(HppClient):
                 "target": {
                     "read_path": [ UInt32, "read" ],
                     "read_subpath": [ ReadSubPath, "readSub" ],
-                    "publish": [ Empty, "publish" ]
+                    "queue_path": [ UInt32, "queuePath" ],
+                    "read_queue": [ Empty, "readQueue" ],
+                    "publish": [ Empty, "publish" ],
+                    "time_scale": [ Float64, "setTimeScale" ],
+                    "queue_depth": [ UInt32, "setQueueDepth" ],
+                    "resume": [ Empty, "resume" ],
                     },
                 },
             }
@@ -95,13 +100,60 @@ class HppOutputQueue(HppClient):
         ## Publication frequency
         self.dt = rospy.get_param ("/sot_controller/dt")
         self.frequency = 1. / self.dt # Hz
-
+        ## When set, references are published at this rate, with a time
+        ## stamp, and the controller interpolates them.
+        if rospy.has_param ("/hpp/target/publish_rate"):
+            self.frequency = rospy.get_param ("/hpp/target/publish_rate")
+            self.dt = 1. / self.frequency
+            self.timeStamping = True
+        else:
+            self.timeStamping = False
+        ## When set, the samples are computed by a thread of the HPP server
+        ## instead of this node.
+        self.streaming = rospy.get_param ("/hpp/target/streaming", False)
+        ## In streaming mode, the lead is adapted to the production delays,
+        ## within these bounds (in seconds), and to the queue depth that the
+        ## consumer publishes on /hpp/target/queue_depth.
+        self.adaptiveLead = rospy.get_param ("/hpp/target/adaptive_lead/enabled", True)
+        self.minLead = rospy.get_param ("/hpp/target/adaptive_lead/min", 0.010)
+        self.maxLead = rospy.get_param ("/hpp/target/adaptive_lead/max", 0.300)
+        ## Publish the accelerations and the feedforward torques.
+        self.postureOutputs = 0
+        if rospy.get_param ("/hpp/target/publish_acceleration", False):
+            self.postureOutputs |= Discretization.SecondDerivative
+        if rospy.get_param ("/hpp/target/publish_torque", False):
+            self.postureOutputs |= Discretization.Feedforward
+        ## Precompute the samples when a path is read.
+        self.cacheSamples = rospy.get_param ("/hpp/target/cache_samples", False)
+        ## When set, constrained paths are converted to explicit splines
+        ## with this resolution (in seconds) and tolerance.
+        self.splineResolution = rospy.get_param ("/hpp/target/explicit_spline/resolution", 0.)
+        self.splineTolerance = rospy.get_param ("/hpp/target/explicit_spline/tolerance", 1e-3)
+        ## Retime the paths within the joint limits before sampling. The
+        ## acceleration limits are required, one per degree of freedom. The
+        ## velocity limits default to the ones of the model.
+        self.retiming = rospy.get_param ("/hpp/target/retiming/enabled", False)
+        self.retimingVelocity = rospy.get_param ("/hpp/target/retiming/velocity", [])
+        self.retimingAcceleration = rospy.get_param ("/hpp/target/retiming/acceleration", [])
+        self.retimingJerk = rospy.get_param ("/hpp/target/retiming/jerk", [])
+        ## The paths sent to queue_path are blended at their junctions
+        ## within this tolerance, over at most this duration (in seconds)
+        ## of each path. Requires retiming.
+        self.blendTolerance = rospy.get_param ("/hpp/target/blending/tolerance", 1e-2)
+        self.blendDuration = rospy.get_param ("/hpp/target/blending/duration", 0.5)
+        ## Check the next samples for collisions while publishing, over this
+        ## horizon (in seconds). 0 disables the monitor.
+        self.monitorHorizon = rospy.get_param ("/hpp/target/collision_monitor/horizon", 0.)
+        ## Generate and compile the forward kinematics of the operational
+        ## frames when a path is read.
+        self.generatedKinematics = rospy.get_param ("/hpp/target/generated_kinematics", False)
 
         self.subscribers = ros_tools.createSubscribers (self, "", self.subscribersDict)
         self.services = ros_tools.createServices (self, "", self.servicesDict)
         self.pubs = ros_tools.createPublishers ("/hpp/target", self.publishersDist)
 
-        self.times = None
+        ## Whether a path was read and not published yet.
+        self.pathRead = False
 
     def _connect (self):
         super(HppOutputQueue, self)._connect ()
@@ -117,6 +169,21 @@ class HppOutputQueue(HppClient):
             except:
                 self.discretization = self._agimus.server.getDiscretization()
                 self.discretization.initializeRosNode ("hpp_discretization", False)
+        # The first sample is applied after the initial advance of publish.
+        self.discretization.setTimeStamping (self.timeStamping, 0.150)
+        self.discretization.setPostureOutputs (self.postureOutputs)
+        self.discretization.setCacheSamples (self.cacheSamples)
+        self.discretization.setCollisionMonitor (self.monitorHorizon > 0,
+                self.monitorHorizon, 0.)
+        self.discretization.setExplicitSpline (self.splineResolution > 0,
+                self.splineResolution, self.splineTolerance)
+        self.discretization.setRetiming (self.retiming,
+                self.retimingVelocity, self.retimingAcceleration,
+                self.retimingJerk)
+        if self.streaming:
+            self.discretization.setAdaptiveLead (self.adaptiveLead,
+                    max(1, int(round(self.minLead * self.frequency))),
+                    max(1, int(round(self.maxLead * self.frequency))))
 
     def _ros_shutdown(self):
         if self.discretization is not None:
@@ -126,6 +193,8 @@ class HppOutputQueue(HppClient):
     def resetTopics (self, msg = None):
         self.hpp()
         self.discretization.resetTopics()
+        # The accelerations and torques are set by ROS parameters.
+        self.discretization.setPostureOutputs (self.postureOutputs)
         rospy.loginfo("Reset topics")
         if msg is not None:
             return std_srvs.srv.EmptyResponse()
@@ -202,20 +271,21 @@ class HppOutputQueue(HppClient):
         return True
 
     def _read (self, pathId, start, L):
-        from math import ceil, floor, sqrt
-        N = int(ceil(abs(L) * self.frequency))
-        rospy.loginfo("Prepare sampling of path {} (t in [ {}, {} ]) into {} points".format(pathId, start, start + L, N+1))
-
-        times = (-1 if L < 0 else 1 ) *np.array(range(N+1), dtype=float) / self.frequency
-        times[-1] = L
-        times += start
-
         hpp = self.hpp()
         path = hpp.problem.getPath(pathId)
-        self.discretization.setPath (path)
+        N = self.discretization.readSubPath (path, start, L, self.dt)
         self.hpptools().deleteServantFromObject (path)
-
-        self.times = times
+        self.pathRead = True
+        if self.retiming:
+            durations = self.discretization.retimedDurations ()
+            rospy.loginfo("Path {} retimed from {} to {} seconds".format(pathId, *durations))
+        if self.generatedKinematics:
+            try:
+                if not self.discretization.setGeneratedKinematics (True):
+                    rospy.logwarn("The kinematics of this robot cannot be generated")
+            except Exception as e:
+                rospy.logerr("Could not generate the kinematics: {}".format(e))
+        rospy.loginfo("Prepare sampling of path {} (t in [ {}, {} ]) into {} points".format(pathId, start, start + L, N))
 
     def read (self, msg):
         pathId = msg.data
@@ -226,55 +296,146 @@ class HppOutputQueue(HppClient):
     def readSub (self, msg):
         self._read (msg.id, msg.start, msg.length)
 
+    ## Append a path to the paths executed without stopping by read_queue.
+    def queuePath (self, msg):
+        hpp = self.hpp()
+        path = hpp.problem.getPath(msg.data)
+        try:
+            self.discretization.queuePath (path)
+        except Exception as e:
+            rospy.logerr("Could not queue path {}: {}".format(msg.data, e))
+        finally:
+            self.hpptools().deleteServantFromObject (path)
+
+    ## Prepare the sampling of the queued paths, blended at their junctions.
+    def readQueue (self, msg):
+        self.hpp()
+        n = self.discretization.queueSize ()
+        try:
+            N = self.discretization.readQueue (self.dt, self.blendTolerance,
+                    self.blendDuration)
+        except Exception as e:
+            rospy.logerr("Could not read the queue of paths: {}".format(e))
+            return
+        self.pathRead = True
+        durations = self.discretization.retimedDurations ()
+        rospy.loginfo("Prepare sampling of {} blended paths (retimed from {} to {} seconds) into {} points".format(n, durations[0], durations[1], N))
+
+    ## Set the speed of the execution (only in streaming mode).
+    def setTimeScale (self, msg):
+        if not self.streaming:
+            rospy.logwarn("The time scale is only used in streaming mode")
+        try:
+            self.hpp()
+            self.discretization.setTimeScale (msg.data)
+        except Exception as e:
+            rospy.logerr("Could not set the time scale: {}".format(e))
+
+    ## Number of samples not yet applied by the consumer of the stream.
+    def setQueueDepth (self, msg):
+        if not self.streaming or self.discretization is None:
+            return
+        try:
+            self.discretization.setConsumerQueueDepth (msg.data)
+        except Exception as e:
+            rospy.logerr("Could not set the queue depth: {}".format(e))
+
+    ## Resume after a collision predicted by the collision monitor.
+    def resume (self, msg):
+        try:
+            self.hpp()
+            self.discretization.clearCollisionStop()
+        except Exception as e:
+            rospy.logerr("Could not resume: {}".format(e))
+
+    def _ready (self):
+        return self.pathRead and self.discretization is not None \
+                and self.discretization.numberOfSamples() > 0
+
     def publishFirst(self, trigger):
         count = 1000
         rate = rospy.Rate (count)
-        if self.times is None:
+        if not self._ready():
             rospy.logwarn ("First message not ready yet. Keep trying during one second.")
-        while self.times is None and count > 0:
+        while not self._ready() and count > 0:
             rate.sleep()
             count -= 1
-        if self.times is None:
+        if not self._ready():
             rospy.logerr("Could not print first message")
             return False, "First message not ready yet. Did you call read_path ?"
 
-        self.discretization.compute (self.times[0])
+        self.discretization.computeSample (0)
         return True, ""
 
+    def _stream(self):
+        N = self.discretization.numberOfSamples()
+        rospy.loginfo("Start streaming path (size is {})".format(N))
+        # Begin with 150ms of points
+        self.discretization.startStreaming (self.dt, int(0.150 * self.frequency))
+        rate = rospy.Rate (100)
+        stopped = False
+        while self.discretization.isStreaming():
+            if self.monitorHorizon > 0 and not stopped and self.discretization.collisionStop():
+                stopped = True
+                rospy.logwarn("Stopping: {}".format(self.discretization.collisionReport()))
+            rate.sleep()
+        rospy.loginfo("Streaming lead: {} samples".format(self.discretization.streamLead()))
+        try:
+            self.discretization.stopStreaming()
+        except Exception as e:
+            rospy.logerr("Streaming failed: {}".format(e))
+        self.pathRead = False
+        self.pubs["publish_done"].publish(Empty())
+        rospy.loginfo("Finish streaming")
+
     def publish(self, empty):
-        rospy.loginfo("Start publishing path (size is {})".format(len(self.times)))
+        if self.streaming:
+            return self._stream()
+        N = self.discretization.numberOfSamples()
+        rospy.loginfo("Start publishing path (size is {})".format(N))
         # The queue in SOT should have about 100ms of points
         n = 0
         advance = 0.150 * self.frequency # Begin with 150ms of points
-        nstar = min(advance, len(self.times))
+        nstar = advance
         start = rospy.Time.now()
         rate = rospy.Rate (100) # Send 10ms every 10ms
         computation_time = rospy.Duration()
         now = rospy.Time.now()
-        while n < len(self.times):
+        stopped = False
+        # The samples follow the time scale, so that a predicted collision
+        # slows the robot down to a stop until /resume is called.
+        while True:
             if n < nstar:
                 prev = rospy.Time.now()
-                self.discretization.compute (self.times[n])
+                if not self.discretization.computeScaledSample (n, self.dt):
+                    break
                 now = rospy.Time.now()
                 computation_time += now - prev
                 n += 1
             else:
+                if self.monitorHorizon > 0:
+                    collision = self.discretization.collisionStop()
+                    if collision and not stopped:
+                        rospy.logwarn("Stopping: {}".format(self.discretization.collisionReport()))
+                    elif stopped and not collision:
+                        rospy.loginfo("Resuming")
+                    stopped = collision
                 rate.sleep()
                 now = rospy.Time.now()
             t = (now - start).to_sec()
-            nstar = min(advance + t * self.frequency, len(self.times))
+            nstar = advance + t * self.frequency
 
-        avg = computation_time.to_sec()/n
+        avg = computation_time.to_sec()/max(n, 1)
         if self.dt <= avg:
             rospy.logwarn("The average sampling time of the reference trajectory ({}) is higher than the execution time ({}). Consider subsampling or preprocessing.".format(avg, self.dt))
-        self.times = None
+        self.pathRead = False
         self.pubs["publish_done"].publish(Empty())
         rospy.loginfo("Finish publishing queue ({})".format(n))
 
     ## \todo rename this service in get_number_of_points.
     #        This information could also be returned by read and readSub.
     def getQueueSize (self, empty):
-        return len(self.times)
+        return self.discretization.numberOfSamples()
 
     def getBasePoseAtParam (self, req):
         hpp = self.hpp()
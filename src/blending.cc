@@ -0,0 +1,193 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <hpp/agimus/blending.hh>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include <hpp/util/debug.hh>
+#include <hpp/pinocchio/configuration.hh>
+#include <hpp/pinocchio/liegroup.hh>
+#include <hpp/core/path-validation.hh>
+#include <hpp/core/path-validation-report.hh>
+#include <hpp/core/path-vector.hh>
+#include <hpp/core/path/spline.hh>
+
+#include <hpp/agimus/explicit-spline.hh>
+
+namespace hpp {
+  namespace agimus {
+    typedef core::path::Spline<core::path::BernsteinBasis, 5> Quintic_t;
+    /// Lie group on which core::path::Spline integrates its parameters.
+    typedef pinocchio::RnxSOnLieGroupMap LieGroup_t;
+
+    /// Number of times the duration of a blend can be halved.
+    static const int maxRefinements = 8;
+
+    namespace {
+      /// Configuration, velocity and acceleration of a path.
+      struct State {
+        pinocchio::Configuration_t q;
+        pinocchio::vector_t v, a;
+      };
+
+      void evaluate (const PathPtr_t& path, value_type t,
+          const DevicePtr_t& device, State& state)
+      {
+        // Step of the finite differences of the acceleration, taken inside
+        // the time range.
+        static const value_type eps (1e-6);
+        const core::interval_t range (path->timeRange());
+        const value_type t0 (std::max (range.first, t - eps)),
+                         t1 (std::min (range.second, t0 + 2 * eps));
+        state.q.resize (device->configSize());
+        state.v.resize (device->numberDof());
+        pinocchio::vector_t v0 (device->numberDof()),
+                            v1 (device->numberDof());
+        if (!path->eval (state.q, t)) {
+          std::ostringstream os;
+          os << "Could not evaluate the path at time " << t;
+          throw std::runtime_error (os.str());
+        }
+        path->derivative (state.v, t, 1);
+        path->derivative (v0, t0, 1);
+        path->derivative (v1, t1, 1);
+        state.a = (v1 - v0) / (t1 - t0);
+      }
+
+      /// Control points of the quintic spline from a to b in duration T,
+      /// in the tangent space at a.q.
+      void controlPoints (const DevicePtr_t& device, const State& a,
+          const State& b, value_type T, Quintic_t::ParameterMatrix_t& P)
+      {
+        const size_type nv (device->numberDof());
+        P.resize (6, nv);
+        pinocchio::vector_t dq (nv), vb (nv), ab (nv);
+        pinocchio::difference<LieGroup_t> (device, b.q, a.q, dq);
+        // The velocity and the acceleration at b are in the tangent space
+        // at b.q.
+        transport (device, a.q, b.q, b.v, b.a, vb, ab);
+        P.row(0).setZero();
+        P.row(1) = (T / 5) * a.v.transpose();
+        P.row(2) = 2 * P.row(1) + (T * T / 20) * a.a.transpose();
+        P.row(5) = dq.transpose();
+        P.row(4) = P.row(5) - (T / 5) * vb.transpose();
+        P.row(3) = 2 * P.row(4) - P.row(5) + (T * T / 20) * ab.transpose();
+      }
+    }
+
+    PathPtr_t blend (const std::vector<PathPtr_t>& paths,
+        const DevicePtr_t& device, value_type tolerance, value_type duration,
+        const core::PathValidationPtr_t& validation)
+    {
+      if (paths.empty())
+        throw std::invalid_argument ("There is no path to blend");
+      core::PathVectorPtr_t result (core::PathVector::create
+          (device->configSize(), device->numberDof()));
+      pinocchio::Configuration_t end (device->configSize()),
+        q (device->configSize());
+      pinocchio::vector_t dq (device->numberDof());
+      Quintic_t::ParameterMatrix_t P;
+      State a, b;
+
+      // Time of the first path from which it is not replaced by a blend.
+      value_type start (paths[0]->timeRange().first);
+      for (std::size_t i = 0; i < paths.size(); ++i) {
+        const PathPtr_t& A (paths[i]);
+        const core::interval_t rangeA (A->timeRange());
+        if (i + 1 == paths.size()) {
+          if (start < rangeA.second)
+            result->appendPath (A->extract (start, rangeA.second));
+          break;
+        }
+        const PathPtr_t& B (paths[i+1]);
+        const core::interval_t rangeB (B->timeRange());
+
+        end = A->end();
+        pinocchio::difference<LieGroup_t> (device, B->initial(), end, dq);
+        if (dq.norm() > tolerance) {
+          std::ostringstream os;
+          os << "Paths " << i << " and " << i+1 << " are not continuous: "
+            "configuration error is " << dq.norm() << ", tolerance is "
+            << tolerance;
+          throw std::invalid_argument (os.str());
+        }
+
+        value_type delta (std::min (duration, std::min
+              (rangeA.second - rangeA.first, rangeB.second - rangeB.first)
+              / 2));
+        // The blend would not satisfy the constraints.
+        if (hasConstraints (A) || hasConstraints (B)) delta = 0;
+        Quintic_t::Ptr_t spline;
+        for (int k = 0; delta > 0 && k <= maxRefinements; ++k, delta /= 2) {
+          evaluate (A, rangeA.second - delta, device, a);
+          evaluate (B, rangeB.first + delta, device, b);
+          controlPoints (device, a, b, 2 * delta, P);
+          // Value of the Bernstein polynomials at 1/2.
+          dq = (P.row(0) + 5 * P.row(1) + 10 * P.row(2) + 10 * P.row(3)
+              + 5 * P.row(4) + P.row(5)).transpose() / 32;
+          pinocchio::integrate<false, LieGroup_t> (device, a.q, dq, q);
+          pinocchio::difference<LieGroup_t> (device, end, q, dq);
+          if (dq.norm() > tolerance) continue;
+          spline = Quintic_t::create (device, core::interval_t (0, 2 * delta),
+              core::ConstraintSetPtr_t());
+          spline->base (a.q);
+          spline->parameters (P);
+          if (validation) {
+            PathPtr_t validPart;
+            core::PathValidationReportPtr_t report;
+            if (!validation->validate (spline, false, validPart, report)) {
+              hppDout (info, "Blend of paths " << i << " and " << i+1
+                  << " over " << 2 * delta << " seconds is not valid");
+              spline.reset();
+              continue;
+            }
+          }
+          break;
+        }
+
+        if (!spline) {
+          hppDout (info, "Could not blend paths " << i << " and " << i+1
+              << " within tolerance " << tolerance
+              << " with a valid blend without constraints");
+          if (start < rangeA.second)
+            result->appendPath (A->extract (start, rangeA.second));
+          start = rangeB.first;
+          continue;
+        }
+        if (start < rangeA.second - delta)
+          result->appendPath (A->extract (start, rangeA.second - delta));
+        result->appendPath (spline);
+        start = rangeB.first + delta;
+      }
+      return result;
+    }
+  } // namespace agimus
+} // namespace hpp
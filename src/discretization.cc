@@ -27,16 +27,35 @@
 // OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <hpp/agimus/discretization.hh>
+#include <hpp/agimus/blending.hh>
+#include <hpp/agimus/explicit-spline.hh>
+#include <hpp/agimus/retiming.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <sstream>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <time.h>
 
 #include <pinocchio/algorithm/frames.hpp>
+#include <pinocchio/algorithm/rnea.hpp>
+#include <hpp/util/debug.hh>
 #include <hpp/util/timer.hh>
 #include <hpp/pinocchio/joint.hh>
 #include <hpp/pinocchio/liegroup-space.hh>
 #include <hpp/pinocchio/center-of-mass-computation.hh>
 #include <hpp/pinocchio/joint-collection.hh>
+#include <hpp/pinocchio/configuration.hh>
+#include <hpp/core/path-vector.hh>
+#include <hpp/core/problem.hh>
+#include <hpp/core/problem-solver.hh>
 
-#include <geometry_msgs/Transform.h>
-#include <dynamic_graph_bridge_msgs/Vector.h>
+#include <ros/time.h>
 
 namespace hpp {
   namespace agimus {
@@ -45,197 +64,1634 @@ namespace hpp {
     using hpp::pinocchio::LiegroupSpace;
     using hpp::pinocchio::size_type;
 
-    static const uint32_t queue_size = 1000;
-
-    void Discretization::COM::compute (pinocchio::DeviceData& d)
-    {
-      switch (option) {
-        case Position:
-          com->compute (d, pinocchio::COM);
-          break;
-        case Derivative:
-          com->compute (d, pinocchio::VELOCITY);
-          break;
-        case PositionAndDerivative:
-          com->compute (d, pinocchio::COMPUTE_ALL);
-          break;
+    namespace {
+      void computeCenterOfMass (const CenterOfMassComputationPtr_t& com,
+          Discretization::ComputationOption option, pinocchio::DeviceData& d)
+      {
+        switch (option) {
+          case Discretization::Position:
+            com->compute (d, pinocchio::COM);
+            break;
+          case Discretization::Derivative:
+            com->compute (d, pinocchio::VELOCITY);
+            break;
+          case Discretization::PositionAndDerivative:
+            com->compute (d, pinocchio::COMPUTE_ALL);
+            break;
+        }
       }
     }
 
-    void Discretization::COM::initPublishers (const std::string& prefix,
-        const std::string& name, ros::NodeHandle& nh)
+    void Discretization::COM::registerChannels (const std::string& name,
+        Discretization& d)
     {
-      if (option&Position)
-        pubQ = nh.advertise <geometry_msgs::Vector3> (
-            prefix + "com/" + name,
-            queue_size, false);
-      if (option&Derivative)
-        pubV = nh.advertise <geometry_msgs::Vector3> (
-            prefix + "velocity/com/" + name,
-            queue_size, false);
+      if ((option&Position) && chQ == noChannel)
+        chQ = d.addChannel ("com/" + name, Vector3Channel);
+      if ((option&Derivative) && chV == noChannel)
+        chV = d.addChannel ("velocity/com/" + name, Vector3Channel);
     }
 
-    void Discretization::FrameData::initPublishers (const std::string& prefix,
-        const std::string& name, ros::NodeHandle& nh)
+    void Discretization::FrameData::registerChannels (const std::string& name,
+        Discretization& d)
     {
-      if (option&Position)
-        pubQ = nh.advertise <geometry_msgs::Transform> (
-            prefix + "op_frame/" + name,
-            queue_size, false);
-      if (option&Derivative)
-        pubV = nh.advertise <dynamic_graph_bridge_msgs::Vector> (
-            prefix + "velocity/op_frame/" + name,
-            queue_size, false);
+      if ((option&Position) && chQ == noChannel)
+        chQ = d.addChannel ("op_frame/" + name, TransformChannel);
+      if ((option&Derivative) && chV == noChannel)
+        chV = d.addChannel ("velocity/op_frame/" + name, VectorChannel);
     }
 
     Discretization::~Discretization ()
     {
+      stopCollisionMonitor();
+      try {
+        stopStreaming();
+      } catch (const std::exception&) {
+        // The error of the streaming thread cannot be reported any more.
+      }
       shutdownRos();
     }
 
-    void Discretization::compute (value_type time)
+    namespace {
+      /// Incremented each time the geometry of a robot changes.
+      /// \note protected by Discretization::geometryMutex.
+      std::size_t geometryVersion = 0;
+      /// Whether the streaming threads must release their DeviceData.
+      boost::atomic<bool> releaseDevices (false);
+
+      /// Path that the calling thread can evaluate while other threads
+      /// evaluate the given one: a copy if it has constraints, as their
+      /// projection is not reentrant.
+      PathPtr_t evaluable (const PathPtr_t& path)
+      {
+        return hasConstraints (path) ? path->copy() : path;
+      }
+    }
+
+    namespace {
+      /// Publication slot of a call to Discretization::compute.
+      ///
+      /// If the slot is not released explicitly (for instance because the
+      /// evaluation of the path failed), it is released on destruction so
+      /// that the following calls are not blocked.
+      struct PublicationTicket
+      {
+        boost::mutex& mutex;
+        boost::condition_variable& cond;
+        std::size_t& nextPublished;
+        const std::size_t ticket;
+        bool released;
+
+        PublicationTicket (boost::mutex& m, boost::condition_variable& c,
+            std::size_t& next, std::size_t t)
+          : mutex (m), cond (c), nextPublished (next), ticket (t)
+          , released (false)
+        {}
+
+        /// Wait until all the previous calls have published.
+        /// \param lock a lock on \c mutex
+        void wait (boost::mutex::scoped_lock& lock)
+        {
+          while (nextPublished != ticket) cond.wait (lock);
+        }
+
+        /// \note must be called with \c mutex locked.
+        void release ()
+        {
+          ++nextPublished;
+          released = true;
+          cond.notify_all();
+        }
+
+        ~PublicationTicket ()
+        {
+          if (released) return;
+          boost::mutex::scoped_lock lock (mutex);
+          wait (lock);
+          release ();
+        }
+      };
+    }
+
+    Discretization::Sample& Discretization::threadSample ()
+    {
+      if (samples_.get() == NULL) samples_.reset (new Sample);
+      return *samples_;
+    }
+
+    PathPtr_t Discretization::currentPath ()
     {
       boost::mutex::scoped_lock lock(mutex_);
       if (!path_)
         throw std::logic_error ("Path is not set");
-      HPP_START_TIMECOUNTER(discretization);
+      return path_;
+    }
 
-      q_.resize(device_->configSize());
-      v_.resize(device_->numberDof ());
+    Discretization::Kinematics Discretization::kinematics (std::size_t tick)
+      const
+    {
+      bool frames (false), compiled (kernel_);
+      for (std::size_t i = 0; i < frames_.size(); ++i)
+        if (active (frames_[i].decimation, tick)) {
+          frames = true;
+          if (compiled && kernel_->index (frames_[i].index) < 0)
+            compiled = false;
+        }
+      // The computation of the center of mass relies on the full forward
+      // kinematics.
+      for (std::size_t i = 0; i < coms_.size(); ++i)
+        if (active (coms_[i].decimation, tick)) {
+          frames = true;
+          compiled = false;
+        }
+      if (compiled && hasFreeflyer_ && kernel_->index (rootTarget) < 0)
+        compiled = false;
+      if (compiled && (frames || hasFreeflyer_)) return CompiledKinematics;
+      if (frames) return FrameKinematics;
+      if (hasFreeflyer_) return JointKinematics;
+      return NoKinematics;
+    }
 
-      bool success = path_->eval (q_, time);
-      if (!success)
-        throw std::runtime_error ("Could not evaluate the path");
-      path_->derivative (v_, time, 1);
+    bool Discretization::Cache::find (value_type time, size_type& i) const
+    {
+      if (times.empty()) return false;
+      const value_type eps (1e-6 * dt);
+      i = std::min ((size_type) (std::abs (time - times[0]) / dt + .5),
+          (size_type) times.size() - 1);
+      if (std::abs (times[i] - time) <= eps) return true;
+      // The last interval of the grid may be shorter.
+      i = (size_type) times.size() - 1;
+      return std::abs (times[i] - time) <= eps;
+    }
+
+    void Discretization::evaluate (const PathPtr_t& path, value_type time,
+        Kinematics kinematics, pinocchio::DeviceSync& device,
+        Sample& sample) const
+    {
+      sample.time = time;
+      sample.q.resize(device_->configSize());
+      sample.v.resize(device_->numberDof ());
+      const bool acceleration (sample.outputs & (SecondDerivative|Feedforward)),
+                 torque (sample.outputs & Feedforward);
+      if (acceleration) sample.a.resize(device_->numberDof ());
+      if (torque) sample.tau.resize(device_->numberDof ());
+
+      size_type i;
+      const bool cached (sample.cache
+          && sample.velocityScale == 1 && sample.velocityScaleRate == 0
+          && (sample.cache->outputs & sample.outputs) == sample.outputs
+          && sample.cache->find (time, i));
+      if (cached) {
+        sample.q = sample.cache->q.col(i);
+        sample.v = sample.cache->v.col(i);
+        if (acceleration) sample.a = sample.cache->a.col(i);
+        if (torque) sample.tau = sample.cache->tau.col(i);
+      } else {
+        sample.evaluator.path (path, device_, sample.fused);
+        bool success = sample.evaluator (time, sample.q, sample.v);
+        if (!success)
+          throw std::runtime_error ("Could not evaluate the path");
+        if (acceleration) {
+          sample.evaluator.acceleration (sample.a);
+          // With a time scale s, the acceleration is s^2 q'' + s' q'.
+          if (sample.velocityScale != 1 || sample.velocityScaleRate != 0) {
+            sample.a *= sample.velocityScale * sample.velocityScale;
+            sample.a += sample.velocityScaleRate * sample.v;
+          }
+        }
+        if (sample.velocityScale != 1) sample.v *= sample.velocityScale;
+      }
+
+      device.currentConfiguration(sample.q);
+      device.currentVelocity     (sample.v);
+      sample.kinematics = kinematics;
+      switch (kinematics) {
+        case CompiledKinematics:
+          sample.targets.resize (sample.kernel->outputSize());
+          sample.kernel->compute (sample.q.data(), sample.v.data(),
+              sample.targets.data());
+          break;
+        case FrameKinematics:
+          device.computeFramesForwardKinematics();
+          break;
+        case JointKinematics:
+          device.computeForwardKinematics(pinocchio::JOINT_POSITION);
+          break;
+        case NoKinematics:
+          break;
+      }
+
+      if (torque && !cached) {
+        const pinocchio::Model& model (device.model());
+        sample.tau.head (model.nv) = ::pinocchio::rnea (model, device.data(),
+            sample.q.head (model.nq), sample.v.head (model.nv),
+            sample.a.head (model.nv));
+        sample.tau.tail (sample.tau.size() - model.nv).setZero();
+      }
 
+      // The centers of mass are computed with the sample, so that the
+      // publication only writes them.
+      for (std::size_t i = 0; i < sample.coms.size(); ++i) {
+        ComOutput& com (sample.coms[i]);
+        computeCenterOfMass (com.com, com.option, device.d());
+        if (com.option & Position) com.position = com.com->com (device.d());
+        if (com.option & Derivative)
+          com.velocity.noalias() = com.com->jacobian (device.d()) * sample.v;
+      }
+    }
+
+    void Discretization::compute (value_type time)
+    {
+      // The DeviceSync takes a DeviceData from the pool of the device so
+      // that concurrent calls do not share any data. It must be acquired
+      // before the publication ticket: a call waiting for its turn to
+      // publish must not hold a ticket that a call waiting for a
+      // DeviceData has to be published before.
       pinocchio::DeviceSync device (device_);
-      device.currentConfiguration(q_);
-      device.currentVelocity     (v_);
-      device.computeFramesForwardKinematics();
+      Sample& sample (threadSample());
+      sample.clock = time;
+      sample.velocityScale = 1;
+      sample.velocityScaleRate = 0;
+      compute (time, device, sample, false);
+    }
+
+    void Discretization::compute (value_type time,
+        pinocchio::DeviceSync& device, Sample& sample, bool fromStream)
+    {
+      PathPtr_t path;
+      std::size_t ticket;
+      Kinematics fk;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (!path_)
+          throw std::logic_error ("Path is not set");
+        if (streaming_ && !fromStream)
+          throw std::logic_error ("Cannot compute samples while streaming");
+        ticket = nextTicket_++;
+        fk = prepare (sample, ticket);
+        path = sample.path;
+        lastRequestedTime_ = (requested_ ? std::max (lastRequestedTime_, time)
+            : time);
+        requested_ = true;
+        if (!monitorStop_) monitorCond_.notify_one();
+      }
+      PublicationTicket order (mutex_, published_, nextPublished_, ticket);
+
+      sample.tick = ticket;
+      // The preview is evaluated first as it overwrites the data of the
+      // device.
+      evaluatePreview (path, time, device, sample);
+      evaluate (path, time, fk, device, sample);
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        order.wait (lock);
+        // The time counter is shared by all the threads, so only the
+        // serialized publication is measured.
+        HPP_START_TIMECOUNTER(discretization);
+        publish (device, sample);
+        order.release ();
+
+        HPP_STOP_TIMECOUNTER(discretization);
+        HPP_DISPLAY_LAST_TIMECOUNTER(discretization);
+        HPP_DISPLAY_TIMECOUNTER(discretization);
+      }
+    }
 
-      dynamic_graph_bridge_msgs::Vector qmsgs;
+    Discretization::Kinematics Discretization::prepare (Sample& sample,
+        std::size_t tick) const
+    {
+      const Kinematics fk (kinematics (tick));
+      if (fk == CompiledKinematics) sample.kernel = kernel_;
+      if (sample.source != path_) {
+        sample.source = path_;
+        sample.path = evaluable (path_);
+      }
+      sample.fused = fusedEvaluation_;
+      sample.outputs = postureOutputs_;
+      if (cache_ && cache_->path == path_) sample.cache = cache_;
+      else sample.cache.reset();
+      // The frames and the centers of mass may change before the sample
+      // is published. The vectors keep their capacity, so that the loop of
+      // the stream does not allocate memory once the first tick is done.
+      sample.frames.clear();
+      for (std::size_t i = 0; i < frames_.size(); ++i) {
+        const FrameData& frame (frames_[i]);
+        if (!active (frame.decimation, tick)) continue;
+        FrameOutput output = { frame.index, frame.option, frame.chQ,
+          frame.chV };
+        sample.frames.push_back (output);
+      }
+      sample.coms.clear();
+      for (std::size_t i = 0; i < coms_.size(); ++i) {
+        const COM& com (coms_[i]);
+        if (!active (com.decimation, tick)) continue;
+        ComOutput output;
+        output.com = com.com;
+        output.option = com.option;
+        output.chQ = com.chQ;
+        output.chV = com.chV;
+        sample.coms.push_back (output);
+      }
+      sample.topicsVersion = topicsVersion_;
+      PreviewBuffer& preview (sample.preview);
+      if (preview.version != preview_.version) {
+        preview.version = preview_.version;
+        preview.size = preview_.size;
+        preview.dt = preview_.dt;
+        preview.frames = preview_.frames;
+        preview.count = 0;
+      }
+      return fk;
+    }
+
+    void Discretization::posture (pinocchio::DeviceSync& device,
+        const Sample& sample, vectorOut_t q) const
+    {
       size_type sizeFreeflyer = (hasFreeflyer_ ? 6 : 0);
-      qmsgs.data.resize(qView_.nbIndices()+sizeFreeflyer);
-      Eigen::Map<pinocchio::vector_t> (qmsgs.data.data()+sizeFreeflyer,
-				       qView_.nbIndices()) = qView_.rview(q_);
+      Eigen::Map<pinocchio::vector_t> (q.data()+sizeFreeflyer,
+				       qView_.nbIndices()) = qView_.rview(sample.q);
       if (hasFreeflyer_) { // Set root joint position
         // TODO at the moment, we must convert the quaternion into RPY values.
-        const pinocchio::SE3& oMrj = device.data().oMi[1];
-        Eigen::Map<pinocchio::vector3_t> (qmsgs.data.data()  ) = oMrj.translation();
-        Eigen::Map<pinocchio::vector3_t> (qmsgs.data.data()+3) = oMrj.rotation().eulerAngles (2, 1, 0);
+        if (sample.kinematics == CompiledKinematics) {
+          const value_type* root (sample.target (rootTarget));
+          q.head<3>() = Eigen::Map<const Eigen::Vector3d> (root);
+          q.segment<3>(3) = Eigen::Quaterniond (root[6], root[3], root[4],
+              root[5]).toRotationMatrix().eulerAngles (2, 1, 0);
+        } else {
+          const pinocchio::SE3& oMrj = device.data().oMi[1];
+          q.head<3>() = oMrj.translation();
+          q.segment<3>(3) = oMrj.rotation().eulerAngles (2, 1, 0);
+        }
       }
-      pubQ.publish (qmsgs);
+    }
 
-      qmsgs.data.resize(vView_.nbIndices()+sizeFreeflyer);
-      Eigen::Map<pinocchio::vector_t> (qmsgs.data.data()+sizeFreeflyer,
-				       vView_.nbIndices()) = vView_.rview(v_);
+    void Discretization::postureTangent (const vector_t& x,
+        vectorOut_t v) const
+    {
+      size_type sizeFreeflyer = (hasFreeflyer_ ? 6 : 0);
+      Eigen::Map<pinocchio::vector_t> (v.data()+sizeFreeflyer,
+				       vView_.nbIndices()) = vView_.rview(x);
       { // TODO Set root joint velocity
-        Eigen::Map<pinocchio::vector_t> (qmsgs.data.data(),
-					 sizeFreeflyer).setZero();
+        v.head(sizeFreeflyer).setZero();
       }
-      pubV.publish (qmsgs);
+    }
 
-      for (std::size_t i = 0; i < frames_.size(); ++i) {
-        FrameData& frame = frames_[i];
+    void Discretization::publish (pinocchio::DeviceSync& device,
+        const Sample& sample)
+    {
+      for (std::size_t i = 0; i < sinks_.size(); ++i)
+        sinks_[i]->beginTick (sample.tick, sample.time);
+
+      if (stamping_) {
+        if (!stampOriginSet_) {
+          stampWallTime_ = ros::WallTime::now().toSec() + stampDelay_;
+          stampTime_ = sample.clock;
+          stampOriginSet_ = true;
+        }
+        vectorOut_t stamp (buffer (3));
+        stamp[0] = sample.time;
+        stamp[1] = stampWallTime_ + (sample.clock - stampTime_);
+        stamp[2] = (value_type) sample.tick;
+        write (stampChannel_, stamp);
+      }
+
+      vectorOut_t q (buffer (postureSize()));
+      posture (device, sample, q);
+      write (qChannel_, q);
+
+      vectorOut_t v (buffer (postureVelocitySize()));
+      postureVelocity (sample, v);
+      write (vChannel_, v);
+
+      if ((sample.outputs & SecondDerivative) && aChannel_ != noChannel) {
+        vectorOut_t a (buffer (postureVelocitySize()));
+        postureTangent (sample.a, a);
+        write (aChannel_, a);
+      }
+      if ((sample.outputs & Feedforward) && tauChannel_ != noChannel) {
+        vectorOut_t tau (buffer (postureVelocitySize()));
+        postureTangent (sample.tau, tau);
+        write (tauChannel_, tau);
+      }
+
+      // The channels of the frames and of the centers of mass are removed
+      // by resetTopics.
+      const bool topics (sample.topicsVersion == topicsVersion_);
+      for (std::size_t i = 0; topics && i < sample.frames.size(); ++i) {
+        const FrameOutput& frame = sample.frames[i];
+        if (sample.kinematics == CompiledKinematics) {
+          const value_type* target (sample.target (frame.index));
+          if (frame.option&Position)
+            write (frame.chQ, Eigen::Map<const Eigen::Matrix<value_type, 7, 1> >
+                (target));
+          if (frame.option&Derivative)
+            write (frame.chV, Eigen::Map<const Eigen::Matrix<value_type, 6, 1> >
+                (target + 7));
+          continue;
+        }
         if (frame.option&Position)
         {
           const pinocchio::SE3& oMf = device.data().oMf[frame.index];
-          geometry_msgs::Transform M;
-          M.translation.x = oMf.translation()[0];
-          M.translation.y = oMf.translation()[1];
-          M.translation.z = oMf.translation()[2];
-          pinocchio::SE3::Quaternion q (oMf.rotation());
-          M.rotation.w = q.w();
-          M.rotation.x = q.x();
-          M.rotation.y = q.y();
-          M.rotation.z = q.z();
-          frame.pubQ.publish (M);
+          vectorOut_t pose (buffer (7));
+          pose.head<3>() = oMf.translation();
+          pose.tail<4>() = pinocchio::SE3::Quaternion (oMf.rotation()).coeffs();
+          write (frame.chQ, pose);
         }
         if (frame.option&Derivative)
         {
-          dynamic_graph_bridge_msgs::Vector velocity;
-          velocity.data.resize(6);
-          Eigen::Map<Eigen::Matrix<pinocchio::value_type, 6, 1> > v (velocity.data.data());
-          v = ::pinocchio::getFrameVelocity (device.model(), device.data(), frame.index).toVector();
-          frame.pubV.publish (velocity);
+          vectorOut_t velocity (buffer (6));
+          velocity = ::pinocchio::getFrameVelocity (device.model(), device.data(), frame.index).toVector();
+          write (frame.chV, velocity);
         }
       }
 
-      for (std::size_t i = 0; i < coms_.size(); ++i) {
-        COM& com = coms_[i];
-        com.compute(device.d());
-        // publish it.
-        if (com.option & Position) {
-          pinocchio::vector3_t v (coms_[i].com->com (device.d()));
-          geometry_msgs::Vector3 msg;
-          msg.x = v[0];
-          msg.y = v[1];
-          msg.z = v[2];
-          com.pubQ.publish (msg);
+      for (std::size_t i = 0; topics && i < sample.coms.size(); ++i) {
+        const ComOutput& com = sample.coms[i];
+        if (com.option & Position) write (com.chQ, com.position);
+        if (com.option & Derivative) write (com.chV, com.velocity);
+      }
+
+      publishPreview (sample);
+
+      for (std::size_t i = 0; i < sinks_.size(); ++i)
+        sinks_[i]->commitTick ();
+    }
+
+    void Discretization::previewSample (pinocchio::DeviceSync& device,
+        const Sample& sample, const PreviewBuffer& buffer,
+        vectorOut_t column) const
+    {
+      const size_type nq (sample.q.size()), nv (sample.v.size());
+      column[0] = sample.time;
+      column.segment (1, nq) = sample.q;
+      column.segment (1+nq, nv) = sample.v;
+      size_type r = 1 + nq + nv;
+      const pinocchio::SE3 oMrj (device.data().oMi.size() > 1 ?
+          device.data().oMi[1] : pinocchio::SE3::Identity());
+      column.segment<3>(r) = oMrj.translation();
+      column.segment<4>(r+3) =
+        pinocchio::SE3::Quaternion (oMrj.rotation()).coeffs();
+      r += 7;
+      for (std::size_t i = 0; i < buffer.frames.size(); ++i, r += 7) {
+        const pinocchio::SE3& oMf = device.data().oMf[buffer.frames[i]];
+        column.segment<3>(r) = oMf.translation();
+        column.segment<4>(r+3) =
+          pinocchio::SE3::Quaternion (oMf.rotation()).coeffs();
+      }
+    }
+
+    void Discretization::evaluatePreview (const PathPtr_t& path,
+        value_type time, pinocchio::DeviceSync& device, Sample& sample) const
+    {
+      PreviewBuffer& p (sample.preview);
+      if (p.size == 0) return;
+      if (!p.sample) p.sample.reset (new Sample);
+      p.sample->fused = sample.fused;
+      const value_type eps (1e-3 * p.dt);
+      const size_type rows (1 + device_->configSize() + device_->numberDof()
+          + 7 * (1 + (size_type) p.frames.size()));
+      if (p.path != path || p.samples.rows() != rows
+          || p.samples.cols() != p.size) {
+        p.path = path;
+        p.samples.resize (rows, p.size);
+        p.count = 0;
+      }
+
+      // Drop the samples that are in the past.
+      while (p.count > 0 && p.samples (0, p.first) < time - eps) {
+        p.first = (p.first + 1) % p.size;
+        --p.count;
+      }
+      // The buffer cannot be reused if the current time is not on the grid.
+      if (p.count > 0 && std::abs (p.samples (0, p.first) - time) > eps)
+        p.count = 0;
+      if (p.count == 0) p.first = 0;
+
+      const value_type tmax (path->timeRange().second);
+      while (p.count < p.size) {
+        value_type t (std::min (time + (value_type)p.count * p.dt, tmax));
+        evaluate (path, t, FrameKinematics, device, *p.sample);
+        previewSample (device, *p.sample, p,
+            p.samples.col ((p.first + p.count) % p.size));
+        ++p.count;
+      }
+    }
+
+    void Discretization::publishPreview (const Sample& sample)
+    {
+      const PreviewBuffer& b (sample.preview);
+      Preview& p (preview_);
+      // The settings changed since the evaluation.
+      if (p.size == 0 || b.version != p.version || b.count < b.size) return;
+      resizePreview ();
+      const size_type nq (device_->configSize()), nv (device_->numberDof()),
+            np (postureSize()), npv (postureVelocitySize());
+      const size_type nf (7 * (size_type) p.frames.size()),
+            sizeFreeflyer (hasFreeflyer_ ? 6 : 0);
+      for (size_type i = 0; i < p.size; ++i) {
+        const pinocchio::matrix_t::ConstColXpr column
+          (b.samples.col ((b.first + i) % b.size));
+        p.q = column.segment (1, nq);
+        p.v = column.segment (1+nq, nv);
+        Eigen::Map<pinocchio::vector_t> (p.posture.data()+sizeFreeflyer,
+            qView_.nbIndices()) = qView_.rview(p.q);
+        if (hasFreeflyer_) {
+          const value_type* root (column.data() + 1 + nq + nv);
+          p.posture.head<3>() = Eigen::Map<const Eigen::Vector3d> (root);
+          p.posture.segment<3>(3) = Eigen::Quaterniond (root[6], root[3],
+              root[4], root[5]).toRotationMatrix().eulerAngles (2, 1, 0);
+        }
+        postureTangent (p.v, p.tangent);
+        p.window (i, 0) = column[0];
+        p.window.row(i).segment (1, np) = p.posture.transpose();
+        p.window.row(i).segment (1+np, npv) = p.tangent.transpose();
+        p.window.row(i).tail (nf) = column.tail (nf).transpose();
+      }
+      for (std::size_t i = 0; i < sinks_.size(); ++i)
+        sinks_[i]->writeMatrix (p.channel, p.window);
+    }
+
+    void Discretization::resizePreview ()
+    {
+      Preview& p (preview_);
+      const size_type np (postureSize()), npv (postureVelocitySize());
+      p.window.resize (p.size, 1 + np + npv + 7 * (size_type) p.frames.size());
+      p.q.resize (device_->configSize());
+      p.v.resize (device_->numberDof());
+      p.posture.resize (np);
+      p.tangent.resize (npv);
+    }
+
+    void Discretization::previewWindow (size_type size, value_type dt)
+    {
+      if (size > 0 && dt <= 0)
+        throw std::invalid_argument ("The time step of the preview window "
+            "must be positive");
+      boost::mutex::scoped_lock lock(mutex_);
+      preview_.size = size;
+      preview_.dt = dt;
+      ++preview_.version;
+      if (size > 0 && preview_.channel == noChannel)
+        preview_.channel = addChannel ("preview", MatrixChannel);
+    }
+
+    bool Discretization::addPreviewFrame (const std::string& name)
+    {
+      const pinocchio::Model& model = device_->model();
+      if (!model.existFrame (name)) return false;
+      boost::mutex::scoped_lock lock(mutex_);
+      preview_.frames.push_back (model.getFrameId(name));
+      ++preview_.version;
+      return true;
+    }
+
+    Configuration_t Discretization::configAtTime (value_type time)
+    {
+      PathPtr_t path (evaluable (currentPath()));
+      Configuration_t q (device_->configSize());
+      if (!path->eval (q, time))
+        throw std::runtime_error ("Could not evaluate the path");
+      return q;
+    }
+
+    vector_t Discretization::velocityAtTime (value_type time)
+    {
+      PathPtr_t path (evaluable (currentPath()));
+      vector_t v (device_->numberDof());
+      path->derivative (v, time, 1);
+      return v;
+    }
+
+    vector_t Discretization::framePoseAtTime (const std::string& name,
+        value_type time)
+    {
+      const pinocchio::Model& model = device_->model();
+      if (!model.existFrame (name))
+        throw std::invalid_argument ("No frame " + name);
+      pinocchio::FrameIndex index = model.getFrameId(name);
+
+      PathPtr_t path (evaluable (currentPath()));
+      Sample sample;
+      pinocchio::DeviceSync device (device_);
+      evaluate (path, time, FrameKinematics, device, sample);
+
+      const pinocchio::SE3& oMf = device.data().oMf[index];
+      vector_t pose (7);
+      pose.head<3>() = oMf.translation();
+      pose.tail<4>() = pinocchio::SE3::Quaternion (oMf.rotation()).coeffs();
+      return pose;
+    }
+
+    void Discretization::splicePath (const PathPtr_t& p, value_type time,
+        value_type tolerance)
+    {
+      // The current path is evaluated through a copy, as it may be
+      // evaluated by other threads.
+      const PathPtr_t current (currentPath()), copy (evaluable (current)),
+            next (retimedPath (explicitPath (p)));
+      const core::interval_t range (current->timeRange()),
+            nextRange (next->timeRange());
+      if (range.first != 0)
+        throw std::invalid_argument ("The time range of the current path "
+            "must start at 0");
+      if (time < range.first || time > range.second) {
+        std::ostringstream os;
+        os << "Splice time " << time << " is not in the time range of the "
+          "current path [ " << range.first << ", " << range.second << " ]";
+        throw std::invalid_argument (os.str());
+      }
+
+      // Check continuity of the configuration and of the velocity.
+      Configuration_t q0 (device_->configSize()), q1 (device_->configSize());
+      vector_t v0 (device_->numberDof()), v1 (device_->numberDof()),
+               dq (device_->numberDof());
+      if (!copy->eval (q0, time) || !next->eval (q1, nextRange.first))
+        throw std::runtime_error ("Could not evaluate the paths at the "
+            "splice time");
+      copy->derivative (v0, time, 1);
+      next->derivative (v1, nextRange.first, 1);
+      pinocchio::difference (device_, q1, q0, dq);
+      const value_type errorQ (dq.norm()), errorV ((v1 - v0).norm());
+      if (errorQ > tolerance || errorV > tolerance) {
+        std::ostringstream os;
+        os << "Paths are not continuous at splice time " << time
+          << ": configuration error is " << errorQ
+          << ", velocity error is " << errorV
+          << ", tolerance is " << tolerance;
+        throw std::invalid_argument (os.str());
+      }
+
+      core::PathVectorPtr_t spliced (core::PathVector::create
+          (current->outputSize(), current->outputDerivativeSize()));
+      if (time > range.first)
+        spliced->appendPath (copy->extract (range.first, time));
+      spliced->appendPath (next);
+
+      boost::mutex::scoped_lock lock(mutex_);
+      if (path_ != current)
+        throw std::logic_error ("The path was changed while splicing");
+      if (requested_ && lastRequestedTime_ >= time) {
+        std::ostringstream os;
+        os << "Cannot splice at time " << time << ": time "
+          << lastRequestedTime_ << " has already been computed";
+        throw std::logic_error (os.str());
+      }
+      if (gridSize_ > 0 && gridLength_ < 0)
+        throw std::logic_error ("Cannot splice a backward time grid");
+
+      path_ = spliced;
+      cache_.reset();
+      if (gridSize_ > 0) {
+        gridLength_ = time + (nextRange.second - nextRange.first)
+          - gridStart_;
+        gridSize_ = gridSize (gridLength_, gridDt_);
+      }
+    }
+
+    size_type Discretization::gridSize (value_type length, value_type dt)
+    {
+      // The tolerance avoids a last interval of almost zero length due to
+      // rounding errors.
+      return (size_type) std::ceil (std::abs (length) / dt - 1e-9) + 1;
+    }
+
+    size_type Discretization::timeGrid (value_type start, value_type length,
+        value_type dt)
+    {
+      if (dt <= 0)
+        throw std::invalid_argument ("The time step must be positive");
+      boost::mutex::scoped_lock lock(mutex_);
+      gridStart_ = start;
+      gridLength_ = length;
+      gridDt_ = dt;
+      gridSize_ = gridSize (length, dt);
+      const size_type size (gridSize_);
+      lock.unlock();
+      fillCache();
+      return size;
+    }
+
+    void Discretization::explicitSpline (bool enable, value_type resolution,
+        value_type tolerance)
+    {
+      if (enable && (resolution <= 0 || tolerance <= 0))
+        throw std::invalid_argument ("The resolution and the tolerance must "
+            "be positive");
+      boost::mutex::scoped_lock lock(mutex_);
+      splineResolution_ = (enable ? resolution : 0);
+      splineTolerance_ = tolerance;
+    }
+
+    PathPtr_t Discretization::explicitPath (const PathPtr_t& path)
+    {
+      value_type resolution, tolerance;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        resolution = splineResolution_;
+        tolerance = splineTolerance_;
+      }
+      if (resolution <= 0 || !path || !hasConstraints (path)) return path;
+      return agimus::explicitSpline (path, device_, resolution, tolerance,
+          device_->numberDeviceData());
+    }
+
+    void Discretization::retiming (bool enable, const vector_t& velocity,
+        const vector_t& acceleration, const vector_t& jerk)
+    {
+      const size_type nv (device_->numberDof());
+      if (enable && ((velocity.size() != 0 && velocity.size() != nv)
+            || acceleration.size() != nv
+            || (jerk.size() != 0 && jerk.size() != nv)))
+        throw std::invalid_argument ("The limits must be of the size of the "
+            "velocity of the robot");
+      boost::mutex::scoped_lock lock(mutex_);
+      retiming_ = enable;
+      retimingVelocity_ = velocity;
+      if (enable && velocity.size() == 0) {
+        // The model has no limit for the extra degrees of freedom.
+        const pinocchio::Model& model (device_->model());
+        retimingVelocity_ = vector_t::Zero (nv);
+        retimingVelocity_.head (model.nv) = model.velocityLimit;
+      }
+      retimingAcceleration_ = acceleration;
+      retimingJerk_ = jerk;
+    }
+
+    vector_t Discretization::retimedDurations ()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return retimedDurations_;
+    }
+
+    PathPtr_t Discretization::retimedPath (const PathPtr_t& path)
+    {
+      vector_t velocity, acceleration, jerk;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (!retiming_ || !path) return path;
+        velocity = retimingVelocity_;
+        acceleration = retimingAcceleration_;
+        jerk = retimingJerk_;
+      }
+      PathPtr_t retimed (retime (path, device_, velocity, acceleration, jerk,
+            retimingSegments));
+      hppDout (info, "Retimed path from " << path->length() << " to "
+          << retimed->length() << " seconds");
+      boost::mutex::scoped_lock lock(mutex_);
+      retimedDurations_.resize (2);
+      retimedDurations_ << path->length(), retimed->length();
+      return retimed;
+    }
+
+    void Discretization::path (const PathPtr_t& p)
+    {
+      PathPtr_t path (retimedPath (explicitPath (p)));
+      boost::mutex::scoped_lock lock(mutex_);
+      path_ = path;
+      stampOriginSet_ = false;
+      requested_ = false;
+      cache_.reset();
+    }
+
+    size_type Discretization::readSubPath (const PathPtr_t& p,
+        value_type start, value_type length, value_type dt)
+    {
+      bool retiming;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        retiming = retiming_;
+      }
+      if (!retiming) {
+        path (p);
+        return timeGrid (start, length, dt);
+      }
+      const core::interval_t range (p->timeRange());
+      if (start == range.first && length == range.second - range.first)
+        path (p);
+      else
+        path (p->extract (start, start + length));
+      const core::interval_t retimed (currentPath()->timeRange());
+      return timeGrid (retimed.first, retimed.second - retimed.first, dt);
+    }
+
+    void Discretization::queuePath (const PathPtr_t& p)
+    {
+      if (!p) throw std::invalid_argument ("The path must not be null");
+      boost::mutex::scoped_lock lock(mutex_);
+      queue_.push_back (p);
+    }
+
+    size_type Discretization::queueSize ()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return (size_type) queue_.size();
+    }
+
+    void Discretization::clearQueue ()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      queue_.clear();
+    }
+
+    size_type Discretization::readQueue (value_type dt, value_type tolerance,
+        value_type duration)
+    {
+      std::vector<PathPtr_t> paths;
+      core::PathValidationPtr_t validation;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (queue_.empty())
+          throw std::logic_error ("The queue of paths is empty");
+        if (!retiming_)
+          throw std::logic_error ("The queue of paths is executed within "
+              "the limits of the retiming, which must be enabled");
+        paths = queue_;
+        if (problemSolver_ && problemSolver_->problem())
+          validation = problemSolver_->problem()->pathValidation();
+      }
+      path (blend (paths, device_, tolerance, duration, validation));
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        queue_.clear();
+      }
+      const core::interval_t range (currentPath()->timeRange());
+      return timeGrid (range.first, range.second - range.first, dt);
+    }
+
+    void Discretization::problemSolver (core::ProblemSolverPtr_t ps)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      problemSolver_ = ps;
+    }
+
+    size_type Discretization::numberOfSamples ()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return gridSize_;
+    }
+
+    value_type Discretization::timeAtSample (size_type i)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (i < 0 || i >= gridSize_)
+        throw std::out_of_range ("Invalid sample index");
+      return gridTime (i);
+    }
+
+    value_type Discretization::gridTime (size_type i) const
+    {
+      if (i == gridSize_ - 1) return gridStart_ + gridLength_;
+      return gridStart_ + (gridLength_ < 0 ? -1 : 1) * (value_type) i * gridDt_;
+    }
+
+    namespace {
+      void addNanoseconds (timespec& t, long ns)
+      {
+        t.tv_nsec += ns;
+        while (t.tv_nsec >= 1000000000L) {
+          t.tv_nsec -= 1000000000L;
+          ++t.tv_sec;
         }
-        if (com.option & Derivative) {
-          const pinocchio::vector3_t& v (coms_[i].com->jacobian (device.d()) * v_);
-          geometry_msgs::Vector3 msg;
-          msg.x = v[0];
-          msg.y = v[1];
-          msg.z = v[2];
-          com.pubV.publish (msg);
+      }
+
+      value_type seconds (const timespec& t)
+      {
+        return (value_type) t.tv_sec + 1e-9 * (value_type) t.tv_nsec;
+      }
+
+      /// Number of production delays from which the lead is computed, and
+      /// number of samples between two updates of the lead.
+      const std::size_t leadWindow = 1000, leadUpdate = 100;
+    }
+
+    void Discretization::realTime (bool enable, int, int)
+    {
+      if (enable)
+        throw std::logic_error ("The real time mode is not supported: the "
+            "streaming loop locks mutexes and the sinks allocate memory");
+    }
+
+    void Discretization::timeScale (value_type scale)
+    {
+      if (scale < 0)
+        throw std::invalid_argument ("The time scale must be non negative");
+      boost::mutex::scoped_lock lock(mutex_);
+      timeScale_ = scale;
+    }
+
+    void Discretization::timeScaleAcceleration (value_type acceleration)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      timeScaleAcceleration_ = acceleration;
+    }
+
+    bool Discretization::nextStreamTime (size_type tick, value_type period,
+        value_type& time, value_type& scale, value_type& rate)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (streamStop_ || gridSize_ == 0) return false;
+      const value_type last ((value_type) (gridSize_ - 1));
+      rate = 0;
+      if (tick > 0) {
+        // The previous sample was the last one.
+        if (streamIndex_ >= last) return false;
+        value_type delta ((collisionStop_ ? 0 : timeScale_) - streamScale_);
+        if (timeScaleAcceleration_ > 0) {
+          const value_type maxDelta (timeScaleAcceleration_ * period);
+          delta = std::min (maxDelta, std::max (-maxDelta, delta));
         }
+        rate = delta / period;
+        streamScale_ += delta;
+        streamIndex_ = std::min (last, streamIndex_ + streamScale_);
       }
+      const size_type i ((size_type) std::floor (streamIndex_));
+      const value_type u (streamIndex_ - (value_type) i);
+      time = gridTime (i);
+      if (u > 0) time += u * (gridTime (i+1) - time);
+      scale = streamScale_;
+      return true;
+    }
+
+    value_type Discretization::stoppingHorizon () const
+    {
+      const value_type s (std::max (timeScale_, streamScale_));
+      // Path time per second of wall clock at scale 1.
+      const value_type speed (streamPeriod_ > 0 && gridDt_ > 0 ?
+          gridDt_ / streamPeriod_ : 1);
+      value_type horizon ((value_type) streamLead_ * streamPeriod_ * s);
+      if (timeScaleAcceleration_ > 0)
+        horizon += s * s / (2 * timeScaleAcceleration_);
+      return speed * horizon;
+    }
 
-      HPP_STOP_TIMECOUNTER(discretization);
-      HPP_DISPLAY_LAST_TIMECOUNTER(discretization);
-      HPP_DISPLAY_TIMECOUNTER(discretization);
+    bool Discretization::computeScaledSample (size_type i, value_type period)
+    {
+      if (period <= 0)
+        throw std::invalid_argument ("The period must be positive");
+      pinocchio::DeviceSync device (device_);
+      Sample& sample (threadSample());
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (streaming_)
+          throw std::logic_error ("Cannot compute samples while streaming");
+        if (i == 0) {
+          streamStop_ = false;
+          streamIndex_ = 0;
+          streamScale_ = timeScale_;
+          streamLead_ = 0;
+        }
+        streamPeriod_ = period;
+      }
+      value_type time, scale, rate;
+      if (!nextStreamTime (i, period, time, scale, rate)) return false;
+      sample.clock = (value_type) i * period;
+      sample.velocityScale = scale;
+      sample.velocityScaleRate = rate;
+      compute (time, device, sample, false);
+      return true;
     }
 
-    bool Discretization::addCenterOfMass (const std::string& name,
-        const CenterOfMassComputationPtr_t& c, ComputationOption option)
+    void Discretization::stream (value_type period, size_type lead)
+    {
+      // Released while the geometry data of the DeviceData is updated.
+      boost::scoped_ptr<pinocchio::DeviceSync> deviceSync
+        (new pinocchio::DeviceSync (device_));
+      Sample& sample (threadSample());
+      std::string error;
+      try {
+        // Allocate the buffers used by the loop before the first sample
+        // is due: the outputs and the kinematics of the first tick, at
+        // which all the decimated channels are written, and the preview
+        // window.
+        PathPtr_t path;
+        Kinematics fk;
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          if (!path_)
+            throw std::logic_error ("Path is not set");
+          fk = prepare (sample, 0);
+          path = sample.path;
+        }
+        // The evaluator is used whenever the time scale is not 1, so
+        // the cache is bypassed.
+        sample.cache.reset();
+        const value_type time (timeAtSample (0));
+        evaluatePreview (path, time, *deviceSync, sample);
+        evaluate (path, time, fk, *deviceSync, sample);
+        boost::mutex::scoped_lock lock(mutex_);
+        buffer (std::max (std::max (postureSize(), postureVelocitySize()),
+              (size_type) 7));
+        if (preview_.size > 0) resizePreview ();
+      } catch (const std::exception& e) {
+        error = e.what();
+      }
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        streamError_ = error;
+        streamReady_ = true;
+        if (!error.empty()) streaming_ = false;
+        streamCond_.notify_all();
+      }
+      if (!error.empty()) return;
+
+      bool adaptive;
+      size_type minLead, maxLead;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        adaptive = adaptiveLead_;
+        minLead = minLead_;
+        maxLead = maxLead_;
+      }
+      // Delays between the scheduled and the actual production of the
+      // samples, in a circular buffer.
+      std::vector<value_type> delays (adaptive ? leadWindow : 0),
+        sorted (delays.size());
+      // Depth reports are ignored during this number of samples after a
+      // correction.
+      const size_type holdoff (std::max (maxLead,
+            (size_type) std::ceil (.1 / period)));
+
+      const long periodNs ((long) (period * 1e9));
+      timespec next, now;
+      clock_gettime (CLOCK_MONOTONIC, &next);
+      value_type time;
+      try {
+        value_type scale, rate;
+        // Number of periods elapsed since the first sample.
+        size_type periods (0);
+        size_type nbDelays (0), ignoreUntil (0), depth;
+        // Whether the current sample was produced after waiting for its
+        // scheduled time.
+        bool scheduled (false);
+        for (size_type i = 0; nextStreamTime (i, period, time, scale, rate);
+            ++i) {
+          if (releaseDevices) {
+            // Wait for the end of the update of the geometry without
+            // holding a DeviceData, as the update takes all of them.
+            deviceSync.reset();
+            { boost::mutex::scoped_lock geometry (geometryMutex()); }
+            deviceSync.reset (new pinocchio::DeviceSync (device_));
+          }
+          // Deadlines follow the wall clock, whatever the time scale.
+          sample.clock = (value_type) i * period;
+          sample.velocityScaleRate = rate;
+          sample.velocityScale = scale;
+          compute (time, *deviceSync, sample, true);
+
+          if (adaptive) {
+            if (scheduled) {
+              clock_gettime (CLOCK_MONOTONIC, &now);
+              delays[nbDelays % leadWindow] = seconds (now) - seconds (next);
+              ++nbDelays;
+              if (nbDelays % leadUpdate == 0) {
+                const std::size_t n (std::min ((std::size_t) nbDelays,
+                      leadWindow));
+                const std::size_t k ((99 * n) / 100);
+                std::copy (delays.begin(), delays.begin() + n, sorted.begin());
+                std::nth_element (sorted.begin(), sorted.begin() + k,
+                    sorted.begin() + n);
+                const size_type covered ((size_type) std::ceil (
+                      std::max (sorted[k], (value_type) 0) / period));
+                lead = std::min (maxLead, std::max (minLead, covered + 1));
+              }
+            }
+            if (exchangeStreamLead (lead, depth) && i >= ignoreUntil) {
+              // Align the number of samples in advance on the consumer.
+              const size_type ahead (i + 1 - periods);
+              periods += std::min (maxLead, std::max (-maxLead, ahead - depth));
+              ignoreUntil = i + 1 + holdoff;
+            }
+          }
+
+          scheduled = false;
+          // Wait until fewer than lead samples are in advance.
+          while (i + 1 - periods >= std::max (lead, (size_type) 1)) {
+            addNanoseconds (next, periodNs);
+            while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+                  NULL) == EINTR) {}
+            ++periods;
+            scheduled = true;
+          }
+        }
+      } catch (const std::exception& e) {
+        error = e.what();
+      }
+      boost::mutex::scoped_lock lock(mutex_);
+      streamError_ = error;
+      streaming_ = false;
+    }
+
+    void Discretization::startStreaming (value_type period, size_type lead)
+    {
+      if (period <= 0)
+        throw std::invalid_argument ("The streaming period must be positive");
+      if (lead < 0)
+        throw std::invalid_argument ("The lead must be non negative");
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (streaming_)
+          throw std::logic_error ("Already streaming");
+        if (!path_)
+          throw std::logic_error ("Path is not set");
+        if (gridSize_ == 0)
+          throw std::logic_error ("The time grid is not set");
+      }
+      // The previous thread has finished but may not be joined yet.
+      if (streamThread_.joinable()) streamThread_.join();
+
+      boost::mutex::scoped_lock lock(mutex_);
+      streaming_ = true;
+      streamStop_ = false;
+      streamReady_ = false;
+      streamError_.clear();
+      streamIndex_ = 0;
+      streamScale_ = timeScale_;
+      streamPeriod_ = period;
+      if (adaptiveLead_) lead = std::min (maxLead_, std::max (minLead_, lead));
+      streamLead_ = lead;
+      consumerDepth_ = -1;
+      streamThread_ = boost::thread (&Discretization::stream, this, period,
+          lead);
+      while (!streamReady_) streamCond_.wait (lock);
+      if (streamError_.empty()) return;
+
+      const std::string error (streamError_);
+      streamError_.clear();
+      lock.unlock();
+      streamThread_.join();
+      throw std::runtime_error ("Could not start streaming: " + error);
+    }
+
+    void Discretization::stopStreaming ()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        streamStop_ = true;
+      }
+      if (streamThread_.joinable()) streamThread_.join();
+
+      boost::mutex::scoped_lock lock(mutex_);
+      if (streamError_.empty()) return;
+      const std::string error (streamError_);
+      streamError_.clear();
+      throw std::runtime_error ("Streaming stopped on error: " + error);
+    }
+
+    void Discretization::adaptiveLead (bool enable, size_type minLead,
+        size_type maxLead)
+    {
+      if (enable && (minLead < 0 || maxLead < minLead))
+        throw std::invalid_argument ("The bounds of the lead must satisfy "
+            "0 <= minLead <= maxLead");
+      boost::mutex::scoped_lock lock(mutex_);
+      adaptiveLead_ = enable;
+      minLead_ = minLead;
+      maxLead_ = maxLead;
+    }
+
+    void Discretization::consumerQueueDepth (size_type depth)
+    {
+      if (depth < 0)
+        throw std::invalid_argument ("The queue depth must be non negative");
+      boost::mutex::scoped_lock lock(mutex_);
+      if (streaming_) consumerDepth_ = depth;
+    }
+
+    size_type Discretization::streamLead ()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return streamLead_;
+    }
+
+    bool Discretization::exchangeStreamLead (size_type lead, size_type& depth)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      streamLead_ = lead;
+      if (consumerDepth_ < 0) return false;
+      depth = consumerDepth_;
+      consumerDepth_ = -1;
+      return true;
+    }
+
+    bool Discretization::isStreaming ()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return streaming_;
+    }
+
+    boost::mutex& Discretization::geometryMutex ()
+    {
+      static boost::mutex mutex;
+      return mutex;
+    }
+
+    void Discretization::geometryChanged ()
+    {
+      ++geometryVersion;
+    }
+
+    void Discretization::releaseDeviceData (bool release)
+    {
+      releaseDevices = release;
+    }
+
+    void Discretization::collisionMonitor (bool enable, value_type horizon,
+        value_type step)
+    {
+      if (enable && (horizon <= 0 || step < 0))
+        throw std::invalid_argument ("The horizon of the collision monitor "
+            "must be positive and its step non negative");
+      if (enable) {
+        boost::mutex::scoped_lock lock(mutex_);
+        const value_type minimum (stoppingHorizon());
+        if (horizon < minimum) {
+          std::ostringstream os;
+          os << "The horizon of the collision monitor (" << horizon
+            << ") is shorter than the stopping distance (" << minimum << ")";
+          throw std::invalid_argument (os.str());
+        }
+      }
+      stopCollisionMonitor();
+      if (!enable) return;
+      // The streaming thread keeps a DeviceData: the monitor needs another
+      // one.
+      if (device_->numberDeviceData() < 2) {
+        if (isStreaming())
+          throw std::logic_error ("The collision monitor needs a pool of at "
+              "least 2 DeviceData while streaming: call numberOfThreads "
+              "before startStreaming");
+        numberOfThreads (2);
+      }
+      boost::mutex::scoped_lock lock(mutex_);
+      monitorHorizon_ = horizon;
+      monitorStep_ = step;
+      monitorStop_ = false;
+      monitorThread_ = boost::thread (&Discretization::monitor, this);
+    }
+
+    void Discretization::stopCollisionMonitor ()
     {
-      if (!handle_)
-        throw std::logic_error ("Initialize ROS first");
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        monitorStop_ = true;
+        monitorCond_.notify_all();
+      }
+      if (monitorThread_.joinable()) monitorThread_.join();
+    }
+
+    bool Discretization::collisionStop ()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return collisionStop_;
+    }
+
+    std::string Discretization::collisionReport ()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return collisionReport_;
+    }
+
+    void Discretization::clearCollisionStop ()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      collisionStop_ = false;
+      collisionReport_.clear();
+      monitorCond_.notify_all();
+    }
+
+    void Discretization::monitor ()
+    {
+      PathEvaluator evaluator;
+      Configuration_t q (device_->configSize());
+      vector_t v (device_->numberDof());
+      // Configurations are checked up to checkedUntil on checkedPath, with
+      // the geometry of version checkedVersion.
+      PathPtr_t checkedPath;
+      std::size_t checkedVersion (0);
+      value_type checkedUntil (0);
+      // Copy of checkedPath evaluated by the monitor.
+      PathPtr_t monitoredPath;
+
+      boost::mutex::scoped_lock lock(mutex_);
+      while (!monitorStop_) {
+        if (!path_ || !requested_ || collisionStop_) {
+          monitorCond_.timed_wait (lock, boost::posix_time::milliseconds (10));
+          continue;
+        }
+        const PathPtr_t path (path_);
+        const value_type start (lastRequestedTime_);
+        value_type step (monitorStep_ > 0 ? monitorStep_ : gridDt_);
+        if (step <= 0) step = 1e-2;
+        const value_type end (std::min (start + std::max (monitorHorizon_,
+                stoppingHorizon()), path->timeRange().second));
+        lock.unlock();
 
+        bool collision (false), locked (false);
+        std::ostringstream report;
+        {
+          // The DeviceData is taken before the geometry mutex and given back
+          // if the mutex is not free: the geometry is modified while holding
+          // the mutex and all the DeviceData of the pool.
+          pinocchio::DeviceSync device (device_);
+          boost::unique_lock<boost::mutex> geometry (geometryMutex(),
+              boost::try_to_lock);
+          locked = geometry.owns_lock();
+          if (locked && path != checkedPath) monitoredPath = evaluable (path);
+          if (locked && (path != checkedPath
+                || geometryVersion != checkedVersion)) {
+            checkedPath = path;
+            checkedVersion = geometryVersion;
+            checkedUntil = start - step;
+          }
+          if (locked) evaluator.path (monitoredPath, device_, true);
+          for (value_type t = std::max (checkedUntil + step, start);
+              locked && checkedUntil < end; t += step) {
+            t = std::min (t, end);
+            if (!evaluator (t, q, v)) {
+              report << "The path cannot be evaluated at time " << t;
+              collision = true;
+              break;
+            }
+            device.currentConfiguration (q);
+            device.computeForwardKinematics (pinocchio::JOINT_POSITION);
+            device.updateGeometryPlacements ();
+            if (device.collisionTest (true)) {
+              const pinocchio::GeomModel& gmodel (device.geomModel());
+              const ::pinocchio::CollisionPair& pair (gmodel.collisionPairs
+                  [device.geomData().collisionPairIndex]);
+              report << "Collision between "
+                << gmodel.geometryObjects[pair.first].name << " and "
+                << gmodel.geometryObjects[pair.second].name
+                << " predicted at time " << t;
+              collision = true;
+              break;
+            }
+            checkedUntil = t;
+          }
+        }
+
+        lock.lock();
+        if (collision && path == path_) {
+          collisionStop_ = true;
+          collisionReport_ = report.str();
+        } else if (!monitorStop_ && (!locked || (path == path_
+                && start == lastRequestedTime_)))
+          // Wait for new samples. The timeout takes the changes of geometry
+          // into account.
+          monitorCond_.timed_wait (lock, boost::posix_time::milliseconds (10));
+      }
+    }
+
+    bool Discretization::generatedKinematics (bool enable)
+    {
+      const pinocchio::Model& model = device_->model();
+      std::vector<KinematicsKernel::Target> targets;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        kernel_.reset();
+        if (!enable) return true;
+        for (std::size_t i = 0; i < frames_.size(); ++i) {
+          const ::pinocchio::Frame& frame (model.frames[frames_[i].index]);
+          targets.push_back (KinematicsKernel::Target (frame.parent,
+                frame.placement, frames_[i].index));
+        }
+        if (hasFreeflyer_)
+          targets.push_back (KinematicsKernel::Target (1,
+                pinocchio::SE3::Identity(), rootTarget));
+      }
+      // Do not hold the lock while compiling.
+      KinematicsKernelPtr_t kernel (KinematicsKernel::create (model, targets));
+      boost::mutex::scoped_lock lock(mutex_);
+      kernel_ = kernel;
+      return (bool) kernel_;
+    }
+
+    void Discretization::numberOfThreads (size_type n)
+    {
+      if (device_->numberDeviceData() < n)
+        device_->numberDeviceData(n);
+    }
+
+    ChannelIndex Discretization::addChannel (const std::string& name,
+        ChannelType type)
+    {
+      ChannelIndex index (channels_.size());
+      channels_.push_back (Channel (name, type));
+      for (std::size_t i = 0; i < sinks_.size(); ++i)
+        sinks_[i]->addChannel (index, name, type);
+      return index;
+    }
+
+    void Discretization::addSink (const OutputSinkPtr_t& sink)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (std::find (sinks_.begin(), sinks_.end(), sink) != sinks_.end())
+        return;
+      for (std::size_t i = 0; i < channels_.size(); ++i)
+        sink->addChannel (i, channels_[i].name, channels_[i].type);
+      sinks_.push_back (sink);
+    }
+
+    void Discretization::removeSink (const OutputSinkPtr_t& sink)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      sinks_.erase (std::remove (sinks_.begin(), sinks_.end(), sink),
+          sinks_.end());
+    }
+
+    void Discretization::startRecording (const std::string& filename)
+    {
+      stopRecording();
+      fileSink_ = FileSink::create (filename);
+      addSink (fileSink_);
+    }
+
+    void Discretization::stopRecording ()
+    {
+      if (!fileSink_) return;
+      removeSink (fileSink_);
+      fileSink_.reset();
+    }
+
+    bool Discretization::addCenterOfMass (const std::string& name,
+        const CenterOfMassComputationPtr_t& c, ComputationOption option,
+        size_type decimation)
+    {
+      if (decimation < 1)
+        throw std::invalid_argument ("Decimation must be positive");
+      boost::mutex::scoped_lock lock(mutex_);
       for (std::size_t i = 0; i < coms_.size(); ++i)
         if (coms_[i].com == c) {
           coms_[i].option = (ComputationOption)(coms_[i].option | option);
-          coms_[i].initPublishers (topicPrefix_, name, *handle_);
+          coms_[i].registerChannels (name, *this);
           return true;
         }
 
-      coms_.push_back(COM(c, option));
-      coms_.back().initPublishers (topicPrefix_, name, *handle_);
+      coms_.push_back(COM(name, c, option, decimation));
+      coms_.back().registerChannels (name, *this);
       return true;
     }
 
-    bool Discretization::addOperationalFrame (
-        const std::string& name, ComputationOption option)
+    bool Discretization::addOperationalFrame (const std::string& name,
+        ComputationOption option, size_type decimation)
     {
-      if (!handle_)
-        throw std::logic_error ("Initialize ROS first");
-
+      if (decimation < 1)
+        throw std::invalid_argument ("Decimation must be positive");
       const pinocchio::Model& model = device_->model();
       if (!model.existFrame (name)) return false;
 
       pinocchio::FrameIndex index = model.getFrameId(name);
+      boost::mutex::scoped_lock lock(mutex_);
       for (std::size_t i = 0; i < frames_.size(); ++i)
         if (frames_[i].index == index) {
           frames_[i].option = (ComputationOption)(frames_[i].option | option);
-          frames_[i].initPublishers (topicPrefix_, name, *handle_);
+          frames_[i].registerChannels (name, *this);
           return true;
         }
 
-      frames_.push_back(FrameData(index, option));
-      frames_.back().initPublishers (topicPrefix_, name, *handle_);
+      frames_.push_back(FrameData(name, index, option, decimation));
+      frames_.back().registerChannels (name, *this);
       return true;
     }
 
+    bool Discretization::centerOfMassDecimation (const std::string& name,
+        size_type decimation)
+    {
+      if (decimation < 1)
+        throw std::invalid_argument ("Decimation must be positive");
+      boost::mutex::scoped_lock lock(mutex_);
+      for (std::size_t i = 0; i < coms_.size(); ++i)
+        if (coms_[i].name == name) {
+          coms_[i].decimation = decimation;
+          return true;
+        }
+      return false;
+    }
+
+    bool Discretization::operationalFrameDecimation (const std::string& name,
+        size_type decimation)
+    {
+      if (decimation < 1)
+        throw std::invalid_argument ("Decimation must be positive");
+      boost::mutex::scoped_lock lock(mutex_);
+      for (std::size_t i = 0; i < frames_.size(); ++i)
+        if (frames_[i].name == name) {
+          frames_[i].decimation = decimation;
+          return true;
+        }
+      return false;
+    }
+
+    void Discretization::postureOutputs (ComputationOption option)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      postureOutputs_ = option & (SecondDerivative | Feedforward);
+      if ((postureOutputs_ & SecondDerivative) && aChannel_ == noChannel)
+        aChannel_ = addChannel ("acceleration", VectorChannel);
+      if ((postureOutputs_ & Feedforward) && tauChannel_ == noChannel)
+        tauChannel_ = addChannel ("torque", VectorChannel);
+      cache_.reset();
+    }
+
+    void Discretization::cacheSamples (bool enable)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      cacheSamples_ = enable;
+      if (!enable) cache_.reset();
+    }
+
+    void Discretization::fillCache ()
+    {
+      PathPtr_t path;
+      shared_ptr<Cache> cache (new Cache);
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        cache_.reset();
+        if (!cacheSamples_ || !path_ || gridSize_ == 0) return;
+        path = path_;
+        cache->path = path_;
+        cache->outputs = postureOutputs_;
+        cache->dt = gridDt_;
+        cache->times.resize (gridSize_);
+        for (size_type i = 0; i < gridSize_; ++i)
+          cache->times[i] = gridTime (i);
+      }
+      const size_type n ((size_type) cache->times.size()),
+            nq (device_->configSize()), nv (device_->numberDof());
+      cache->q.resize (nq, n);
+      cache->v.resize (nv, n);
+      if (cache->outputs & (SecondDerivative | Feedforward))
+        cache->a.resize (nv, n);
+      if (cache->outputs & Feedforward)
+        cache->tau.resize (nv, n);
+
+      const size_type nbThreads (std::max ((size_type) 1,
+            std::min (device_->numberDeviceData(), n)));
+      std::vector<std::string> errors (nbThreads);
+      boost::thread_group threads;
+      // The projection of constrained paths is not reentrant.
+      for (size_type i = 1; i < nbThreads; ++i)
+        threads.create_thread (boost::bind (&Discretization::fillCacheRange,
+              this, path->copy(), cache.get(), i, nbThreads, &errors[i]));
+      fillCacheRange (path, cache.get(), 0, nbThreads, &errors[0]);
+      threads.join_all();
+      for (size_type i = 0; i < nbThreads; ++i)
+        if (!errors[i].empty())
+          throw std::runtime_error ("Could not precompute the samples: "
+              + errors[i]);
+
+      boost::mutex::scoped_lock lock(mutex_);
+      if (path_ == path) cache_ = cache;
+    }
+
+    void Discretization::fillCacheRange (PathPtr_t path, Cache* cache,
+        size_type first, size_type step, std::string* error) const
+    {
+      try {
+        pinocchio::DeviceSync device (device_);
+        Sample sample;
+        sample.outputs = cache->outputs;
+        for (size_type i = first; i < (size_type) cache->times.size();
+            i += step) {
+          evaluate (path, cache->times[i], NoKinematics, device, sample);
+          cache->q.col(i) = sample.q;
+          cache->v.col(i) = sample.v;
+          if (cache->a.size() > 0) cache->a.col(i) = sample.a;
+          if (cache->tau.size() > 0) cache->tau.col(i) = sample.tau;
+        }
+      } catch (const std::exception& e) {
+        *error = e.what();
+      }
+    }
+
     void Discretization::resetTopics ()
     {
+      boost::mutex::scoped_lock lock(mutex_);
       frames_.clear();
+      ++topicsVersion_;
+      kernel_.reset();
       coms_.clear();
+      const std::size_t version (preview_.version);
+      preview_ = Preview();
+      preview_.version = version + 1;
+      postureOutputs_ = 0;
+      aChannel_ = tauChannel_ = noChannel;
+      channels_.resize (nbFixedChannels_);
+      // The stamp channel is kept as long as it is registered.
+      if (stampChannel_ != noChannel) {
+        stampChannel_ = channels_.size();
+        channels_.push_back (Channel ("stamp", VectorChannel));
+      }
+      for (std::size_t i = 0; i < sinks_.size(); ++i) {
+        sinks_[i]->resetChannels();
+        for (std::size_t j = 0; j < channels_.size(); ++j)
+          sinks_[i]->addChannel (j, channels_[j].name, channels_[j].type);
+      }
     }
 
     void Discretization::setJointNames (const std::vector<std::string>& names)
     {
+      boost::mutex::scoped_lock lock(mutex_);
       hasFreeflyer_ = false;
       qView_ = Eigen::RowBlockIndices();
       vView_ = Eigen::RowBlockIndices();
@@ -274,22 +1730,20 @@ namespace hpp {
         handle_ = new ros::NodeHandle();
         ret = true;
       }
-      pubQ = handle_->advertise <dynamic_graph_bridge_msgs::Vector> (
-          topicPrefix_ + "position",
-          queue_size, false);
-      pubV = handle_->advertise <dynamic_graph_bridge_msgs::Vector> (
-          topicPrefix_ + "velocity",
-          queue_size, false);
+      if (rosSink_) removeSink (rosSink_);
+      rosSink_ = RosSink::create (*handle_, topicPrefix_);
+      addSink (rosSink_);
       return ret;
     }
 
     void Discretization::shutdownRos ()
     {
       if (!handle_) return;
-      boost::mutex::scoped_lock lock(mutex_);
       resetTopics();
-      pubQ.shutdown();
-      pubV.shutdown();
+      removeSink (rosSink_);
+      // Publishers must be shut down before the node handle is deleted.
+      rosSink_.reset();
+      boost::mutex::scoped_lock lock(mutex_);
       if (handle_) delete handle_;
       handle_ = NULL;
     }
@@ -0,0 +1,268 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <hpp/agimus/explicit-spline.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+#include <hpp/pinocchio/configuration.hh>
+#include <hpp/pinocchio/liegroup.hh>
+#include <hpp/core/constraint-set.hh>
+#include <hpp/core/path-vector.hh>
+#include <hpp/core/path/spline.hh>
+
+namespace hpp {
+  namespace agimus {
+    typedef core::path::Spline<core::path::BernsteinBasis, 3> Spline_t;
+    /// Lie group on which core::path::Spline integrates its parameters.
+    typedef pinocchio::RnxSOnLieGroupMap LieGroup_t;
+
+    /// Number of times an interval can be split in two.
+    static const int maxRefinements = 8;
+
+    bool hasConstraints (const PathPtr_t& path)
+    {
+      if (path->constraints()) return true;
+      core::PathVectorPtr_t pv (HPP_DYNAMIC_PTR_CAST (core::PathVector, path));
+      if (!pv) return false;
+      for (std::size_t i = 0; i < pv->numberPaths(); ++i)
+        if (hasConstraints (pv->pathAtRank (i))) return true;
+      return false;
+    }
+
+    void transport (const DevicePtr_t& device, pinocchio::ConfigurationIn_t q0,
+        pinocchio::ConfigurationIn_t q, pinocchio::vectorIn_t v,
+        pinocchio::vectorIn_t a, pinocchio::vectorOut_t dv,
+        pinocchio::vectorOut_t da)
+    {
+      // The step keeps the displacements small enough for the truncation
+      // error and large enough for the rounding errors.
+      const value_type h (1e-4 / std::max ((value_type) 1,
+            std::max (v.norm(), std::sqrt (a.norm()))));
+      const size_type nv (device->numberDof());
+      pinocchio::Configuration_t qt (device->configSize());
+      pinocchio::vector_t w (nv), p0 (nv), pm (nv), pp (nv);
+      pinocchio::difference<LieGroup_t> (device, q, q0, p0);
+      w = -h * v + (h * h / 2) * a;
+      pinocchio::integrate<false, LieGroup_t> (device, q, w, qt);
+      pinocchio::difference<LieGroup_t> (device, qt, q0, pm);
+      w = h * v + (h * h / 2) * a;
+      pinocchio::integrate<false, LieGroup_t> (device, q, w, qt);
+      pinocchio::difference<LieGroup_t> (device, qt, q0, pp);
+      dv = (pp - pm) / (2 * h);
+      da = (pp - 2 * p0 + pm) / (h * h);
+    }
+
+    namespace {
+      /// Constraints of the sub-path at the given time, if any.
+      core::ConstraintSetPtr_t constraintsAt (const PathPtr_t& path,
+          value_type time)
+      {
+        if (path->constraints()) return path->constraints();
+        core::PathVectorPtr_t pv (HPP_DYNAMIC_PTR_CAST (core::PathVector,
+              path));
+        if (!pv || pv->numberPaths() == 0) return core::ConstraintSetPtr_t();
+        value_type local;
+        const std::size_t rank (pv->rankAtParam (time, local));
+        return constraintsAt (pv->pathAtRank (rank), local);
+      }
+
+      struct Knot {
+        value_type time;
+        pinocchio::Configuration_t q;
+        pinocchio::vector_t v;
+        Knot (value_type t) : time (t) {}
+      };
+
+      /// Evaluate one knot every \c step, starting at \c first.
+      struct Worker {
+        PathPtr_t path;
+        const std::vector<Knot*>* knots;
+        std::size_t first, step;
+        bool success;
+        value_type failedTime;
+
+        void operator() ()
+        {
+          success = true;
+          for (std::size_t i = first; i < knots->size(); i += step) {
+            Knot& k (*(*knots)[i]);
+            k.q.resize (path->outputSize());
+            k.v.resize (path->outputDerivativeSize());
+            if (!path->eval (k.q, k.time)) {
+              success = false;
+              failedTime = k.time;
+              return;
+            }
+            path->derivative (k.v, k.time, 1);
+          }
+        }
+      };
+
+      void evaluate (const PathPtr_t& path, const std::vector<Knot*>& knots,
+          size_type nbThreads)
+      {
+        std::size_t n (std::min ((std::size_t) std::max (nbThreads,
+                (size_type) 1), knots.size()));
+        std::vector<Worker> workers (n);
+        boost::thread_group threads;
+        for (std::size_t i = 0; i < n; ++i) {
+          Worker& w (workers[i]);
+          // The projection of constrained paths is not reentrant.
+          w.path = (i == 0 ? path : path->copy());
+          w.knots = &knots;
+          w.first = i;
+          w.step = n;
+          if (i > 0) threads.create_thread (boost::ref (w));
+        }
+        if (n > 0) workers[0]();
+        threads.join_all();
+        for (std::size_t i = 0; i < n; ++i)
+          if (!workers[i].success) {
+            std::ostringstream os;
+            os << "Could not evaluate the path at time "
+              << workers[i].failedTime;
+            throw std::runtime_error (os.str());
+          }
+      }
+
+      /// Spline of [a, b] in the tangent space at a.q.
+      /// \param[out] P control points of the Bernstein basis, one per row.
+      void controlPoints (const DevicePtr_t& device, const Knot& a,
+          const Knot& b, Spline_t::ParameterMatrix_t& P)
+      {
+        const value_type T (b.time - a.time);
+        const size_type nv (device->numberDof());
+        P.resize (4, nv);
+        pinocchio::vector_t dq (nv), vb (nv), ab (nv);
+        pinocchio::difference<LieGroup_t> (device, b.q, a.q, dq);
+        // The velocity at b is in the tangent space at b.q.
+        transport (device, a.q, b.q, b.v, pinocchio::vector_t::Zero (nv), vb,
+            ab);
+        P.row(0).setZero();
+        P.row(1) = (T / 3) * a.v.transpose();
+        P.row(2) = dq.transpose() - (T / 3) * vb.transpose();
+        P.row(3) = dq.transpose();
+      }
+    }
+
+    PathPtr_t explicitSpline (const PathPtr_t& path, const DevicePtr_t& device,
+        value_type resolution, value_type tolerance, size_type nbThreads)
+    {
+      if (resolution <= 0)
+        throw std::invalid_argument ("The resolution must be positive");
+      if (tolerance <= 0)
+        throw std::invalid_argument ("The tolerance must be positive");
+      const core::interval_t range (path->timeRange());
+      const value_type L (range.second - range.first);
+      const size_type N (std::max ((size_type) 1,
+            (size_type) std::ceil (L / resolution - 1e-9)));
+      const value_type minDt (L / (value_type) N
+          / (value_type) (1 << maxRefinements));
+
+      std::list<Knot> knots;
+      std::vector<Knot*> toEvaluate;
+      for (size_type i = 0; i <= N; ++i) {
+        knots.push_back (Knot (i == N ? range.second
+              : range.first + L * (value_type) i / (value_type) N));
+        toEvaluate.push_back (&knots.back());
+      }
+      evaluate (path, toEvaluate, nbThreads);
+
+      // Intervals to check, identified by their first knot.
+      typedef std::list<Knot>::iterator iterator;
+      std::vector<iterator> pending;
+      for (iterator it = knots.begin(); it != --knots.end(); ++it)
+        pending.push_back (it);
+
+      Spline_t::ParameterMatrix_t P;
+      pinocchio::vector_t dq (device->numberDof());
+      pinocchio::Configuration_t q (device->configSize());
+      while (!pending.empty()) {
+        std::list<Knot> middles;
+        toEvaluate.clear();
+        for (std::size_t i = 0; i < pending.size(); ++i) {
+          iterator b (pending[i]); ++b;
+          middles.push_back (Knot (.5 * (pending[i]->time + b->time)));
+          toEvaluate.push_back (&middles.back());
+        }
+        evaluate (path, toEvaluate, nbThreads);
+
+        std::vector<iterator> next;
+        std::list<Knot>::iterator middle (middles.begin());
+        for (std::size_t i = 0; i < pending.size(); ++i) {
+          iterator a (pending[i]), b (a); ++b;
+          controlPoints (device, *a, *b, P);
+          // Value of the Bernstein polynomials at 1/2.
+          dq = (P.row(0) + 3 * P.row(1) + 3 * P.row(2) + P.row(3))
+            .transpose() / 8;
+          pinocchio::integrate<false, LieGroup_t> (device, a->q, dq, q);
+          pinocchio::difference<LieGroup_t> (device, middle->q, q, dq);
+          const value_type error (dq.norm());
+          iterator m (middle++);
+          core::ConstraintSetPtr_t constraints (constraintsAt (path, m->time));
+          const bool satisfied (!constraints || constraints->isSatisfied (q));
+          if (error <= tolerance && satisfied) continue;
+          if (b->time - a->time < 2 * minDt) {
+            std::ostringstream os;
+            os << "Could not approximate the path at time " << m->time
+              << " within tolerance " << tolerance << " (error is " << error
+              << (satisfied ? "" : ", constraints are not satisfied") << ")";
+            throw std::runtime_error (os.str());
+          }
+          iterator inserted (knots.insert (b, *m));
+          next.push_back (a);
+          next.push_back (inserted);
+        }
+        pending.swap (next);
+      }
+
+      core::PathVectorPtr_t result (core::PathVector::create
+          (device->configSize(), device->numberDof()));
+      for (iterator a = knots.begin(), b = ++knots.begin(); b != knots.end();
+          ++a, ++b) {
+        Spline_t::Ptr_t spline (Spline_t::create (device,
+              core::interval_t (0, b->time - a->time),
+              core::ConstraintSetPtr_t()));
+        controlPoints (device, *a, *b, P);
+        spline->base (a->q);
+        spline->parameters (P);
+        result->appendPath (spline);
+      }
+      return result;
+    }
+  } // namespace agimus
+} // namespace hpp
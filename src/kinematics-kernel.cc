@@ -0,0 +1,566 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <hpp/agimus/kinematics-kernel.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <dlfcn.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <pinocchio/multibody/model.hpp>
+#include <pinocchio/multibody/data.hpp>
+#include <pinocchio/algorithm/kinematics.hpp>
+#include <pinocchio/algorithm/joint-configuration.hpp>
+
+namespace hpp {
+  namespace agimus {
+    namespace {
+      /// A scalar of the generated code: either a constant or a variable.
+      struct Scalar {
+        bool constant;
+        value_type value;
+        std::string name;
+        Scalar (value_type v = 0) : constant (true), value (v) {}
+        Scalar (const std::string& n) : constant (false), value (0), name (n) {}
+      };
+
+      /// Term k * a * b of a sum.
+      struct Product {
+        Scalar a, b;
+        value_type k;
+        Product (const Scalar& _a, const Scalar& _b, value_type _k = 1)
+          : a (_a), b (_b), k (_k) {}
+      };
+      typedef std::vector<Product> Sum;
+
+      std::string literal (value_type v)
+      {
+        char buf[32];
+        std::snprintf (buf, sizeof(buf), "%.17g", v);
+        return buf;
+      }
+
+      std::string expression (const Scalar& s)
+      {
+        return s.constant ? "(" + literal (s.value) + ")" : s.name;
+      }
+
+      /// Emit the generated code, folding the constants.
+      class Writer
+      {
+        public:
+          Writer () : n_ (0) {}
+
+          /// Declare a variable equal to a sum of products.
+          /// Products with a null constant factor are skipped.
+          Scalar sum (const Sum& terms)
+          {
+            value_type constant (0);
+            std::ostringstream expr;
+            bool empty (true);
+            for (std::size_t i = 0; i < terms.size(); ++i) {
+              const Product& t (terms[i]);
+              value_type k (t.k);
+              std::string vars;
+              if (t.a.constant) k *= t.a.value;
+              else vars = t.a.name;
+              if (t.b.constant) k *= t.b.value;
+              else vars += (vars.empty() ? "" : "*") + t.b.name;
+              if (k == 0) continue;
+              if (vars.empty()) {
+                constant += k;
+                continue;
+              }
+              if (k == 1) expr << (empty ? "" : " + ") << vars;
+              else if (k == -1) expr << (empty ? "-" : " - ") << vars;
+              else expr << (empty ? "" : " + ") << literal (k) << "*" << vars;
+              empty = false;
+            }
+            if (empty) return Scalar (constant);
+            if (constant != 0) expr << " + " << literal (constant);
+            return declare (expr.str());
+          }
+
+          Scalar declare (const std::string& expr)
+          {
+            std::ostringstream name;
+            name << "x" << n_++;
+            os << "  const double " << name.str() << " = " << expr << ";\n";
+            return Scalar (name.str());
+          }
+
+          std::ostringstream os;
+
+        private:
+          std::size_t n_;
+      };
+
+      struct Placement {
+        Scalar R[3][3], p[3];
+        Placement ()
+        {
+          for (int i = 0; i < 3; ++i) {
+            p[i] = Scalar (0);
+            for (int j = 0; j < 3; ++j) R[i][j] = Scalar (i == j ? 1 : 0);
+          }
+        }
+        Placement (const pinocchio::SE3& M)
+        {
+          for (int i = 0; i < 3; ++i) {
+            p[i] = Scalar (M.translation()[i]);
+            for (int j = 0; j < 3; ++j) R[i][j] = Scalar (M.rotation()(i,j));
+          }
+        }
+      };
+
+      struct Motion {
+        Scalar linear[3], angular[3];
+      };
+
+      /// A * B
+      Placement compose (Writer& w, const Placement& A, const Placement& B)
+      {
+        Placement M;
+        for (int i = 0; i < 3; ++i) {
+          for (int j = 0; j < 3; ++j) {
+            Sum s;
+            for (int k = 0; k < 3; ++k) s.push_back (Product (A.R[i][k], B.R[k][j]));
+            M.R[i][j] = w.sum (s);
+          }
+          Sum s;
+          for (int k = 0; k < 3; ++k) s.push_back (Product (A.R[i][k], B.p[k]));
+          s.push_back (Product (A.p[i], Scalar (1)));
+          M.p[i] = w.sum (s);
+        }
+        return M;
+      }
+
+      /// M^{-1} * m, as pinocchio::SE3::actInv
+      Motion actInv (Writer& w, const Placement& M, const Motion& m)
+      {
+        // d = v - p x w
+        Scalar d[3];
+        for (int i = 0; i < 3; ++i) {
+          const int j ((i+1)%3), k ((i+2)%3);
+          Sum s;
+          s.push_back (Product (m.linear[i], Scalar (1)));
+          s.push_back (Product (M.p[j], m.angular[k], -1));
+          s.push_back (Product (M.p[k], m.angular[j], 1));
+          d[i] = w.sum (s);
+        }
+        Motion r;
+        for (int i = 0; i < 3; ++i) {
+          Sum sl, sa;
+          for (int k = 0; k < 3; ++k) {
+            sl.push_back (Product (M.R[k][i], d[k]));
+            sa.push_back (Product (M.R[k][i], m.angular[k]));
+          }
+          r.linear[i] = w.sum (sl);
+          r.angular[i] = w.sum (sa);
+        }
+        return r;
+      }
+
+      Motion add (Writer& w, const Motion& a, const Motion& b)
+      {
+        Motion r;
+        for (int i = 0; i < 3; ++i) {
+          Sum sl, sa;
+          sl.push_back (Product (a.linear[i], Scalar (1)));
+          sl.push_back (Product (b.linear[i], Scalar (1)));
+          sa.push_back (Product (a.angular[i], Scalar (1)));
+          sa.push_back (Product (b.angular[i], Scalar (1)));
+          r.linear[i] = w.sum (sl);
+          r.angular[i] = w.sum (sa);
+        }
+        return r;
+      }
+
+      std::string index (const char* array, int i)
+      {
+        std::ostringstream os;
+        os << array << "[" << i << "]";
+        return os.str();
+      }
+
+      enum JointKind { Revolute, RevoluteUnbounded, Prismatic, FreeFlyer };
+
+      bool jointKind (const pinocchio::Model::JointModel& j, JointKind& kind,
+          Eigen::Vector3d& axis)
+      {
+        const std::string name (j.shortname());
+        const std::string suffix (name.size() > 0 ? name.substr (name.size()-1)
+            : "");
+        axis = (suffix == "X" ? Eigen::Vector3d::UnitX()
+            : suffix == "Y" ? Eigen::Vector3d::UnitY()
+            : Eigen::Vector3d::UnitZ());
+        if (name == "JointModelRX" || name == "JointModelRY"
+            || name == "JointModelRZ")
+          kind = Revolute;
+        else if (name == "JointModelRUBX" || name == "JointModelRUBY"
+            || name == "JointModelRUBZ")
+          kind = RevoluteUnbounded;
+        else if (name == "JointModelPX" || name == "JointModelPY"
+            || name == "JointModelPZ")
+          kind = Prismatic;
+        else if (name == "JointModelRevoluteUnaligned") {
+          kind = Revolute;
+          axis = boost::get< ::pinocchio::JointModelRevoluteUnaligned>
+            (j.toVariant()).axis;
+        } else if (name == "JointModelPrismaticUnaligned") {
+          kind = Prismatic;
+          axis = boost::get< ::pinocchio::JointModelPrismaticUnaligned>
+            (j.toVariant()).axis;
+        } else if (name == "JointModelFreeFlyer")
+          kind = FreeFlyer;
+        else
+          return false;
+        return true;
+      }
+
+      /// Placement and velocity of a joint relatively to its parent.
+      void jointMotion (Writer& w, const pinocchio::Model::JointModel& j,
+          JointKind kind, const Eigen::Vector3d& u, Placement& M, Motion& m)
+      {
+        const int iq (j.idx_q()), iv (j.idx_v());
+        for (int i = 0; i < 3; ++i) {
+          m.linear[i] = Scalar (0);
+          m.angular[i] = Scalar (0);
+        }
+        switch (kind) {
+          case Revolute:
+          case RevoluteUnbounded:
+            {
+              Scalar c, s;
+              if (kind == Revolute) {
+                c = w.declare ("std::cos(" + index ("q", iq) + ")");
+                s = w.declare ("std::sin(" + index ("q", iq) + ")");
+              } else {
+                c = Scalar (index ("q", iq));
+                s = Scalar (index ("q", iq+1));
+              }
+              // Rodrigues formula: c I + s [u]x + (1-c) u u^T
+              Eigen::Matrix3d S;
+              S <<     0, -u[2],  u[1],
+                    u[2],     0, -u[0],
+                   -u[1],  u[0],     0;
+              for (int a = 0; a < 3; ++a)
+                for (int b = 0; b < 3; ++b) {
+                  Sum sum;
+                  sum.push_back (Product (c,
+                        Scalar ((a == b ? 1 : 0) - u[a]*u[b])));
+                  sum.push_back (Product (s, Scalar (S(a,b))));
+                  sum.push_back (Product (Scalar (u[a]*u[b]), Scalar (1)));
+                  M.R[a][b] = w.sum (sum);
+                }
+              const Scalar dq (index ("v", iv));
+              for (int a = 0; a < 3; ++a)
+                m.angular[a] = w.sum (Sum (1, Product (dq, Scalar (u[a]))));
+            }
+            break;
+          case Prismatic:
+            {
+              const Scalar x (index ("q", iq)), dq (index ("v", iv));
+              for (int a = 0; a < 3; ++a) {
+                M.p[a] = w.sum (Sum (1, Product (x, Scalar (u[a]))));
+                m.linear[a] = w.sum (Sum (1, Product (dq, Scalar (u[a]))));
+              }
+            }
+            break;
+          case FreeFlyer:
+            {
+              for (int a = 0; a < 3; ++a) {
+                M.p[a] = Scalar (index ("q", iq+a));
+                m.linear[a] = Scalar (index ("v", iv+a));
+                m.angular[a] = Scalar (index ("v", iv+3+a));
+              }
+              const std::string x (index ("q", iq+3)), y (index ("q", iq+4)),
+                    z (index ("q", iq+5)), W (index ("q", iq+6));
+              M.R[0][0] = w.declare ("1 - 2*(" + y+"*"+y + " + " + z+"*"+z + ")");
+              M.R[0][1] = w.declare ("2*(" + x+"*"+y + " - " + z+"*"+W + ")");
+              M.R[0][2] = w.declare ("2*(" + x+"*"+z + " + " + y+"*"+W + ")");
+              M.R[1][0] = w.declare ("2*(" + x+"*"+y + " + " + z+"*"+W + ")");
+              M.R[1][1] = w.declare ("1 - 2*(" + x+"*"+x + " + " + z+"*"+z + ")");
+              M.R[1][2] = w.declare ("2*(" + y+"*"+z + " - " + x+"*"+W + ")");
+              M.R[2][0] = w.declare ("2*(" + x+"*"+z + " - " + y+"*"+W + ")");
+              M.R[2][1] = w.declare ("2*(" + y+"*"+z + " + " + x+"*"+W + ")");
+              M.R[2][2] = w.declare ("1 - 2*(" + x+"*"+x + " + " + y+"*"+y + ")");
+            }
+            break;
+        }
+      }
+
+      /// Same algorithm as Eigen::Quaternion from a rotation matrix so that
+      /// the signs are the same.
+      const char* quaternionFunction =
+        "static inline void quaternion (const double* R, double* q)\n"
+        "{\n"
+        "  const double t = R[0] + R[4] + R[8];\n"
+        "  if (t > 0) {\n"
+        "    double s = std::sqrt (t + 1);\n"
+        "    q[3] = .5 * s;\n"
+        "    s = .5 / s;\n"
+        "    q[0] = (R[7] - R[5]) * s;\n"
+        "    q[1] = (R[2] - R[6]) * s;\n"
+        "    q[2] = (R[3] - R[1]) * s;\n"
+        "  } else {\n"
+        "    int i = 0;\n"
+        "    if (R[4] > R[0]) i = 1;\n"
+        "    if (R[8] > R[4*i]) i = 2;\n"
+        "    const int j = (i+1)%3, k = (j+1)%3;\n"
+        "    double s = std::sqrt (R[4*i] - R[4*j] - R[4*k] + 1);\n"
+        "    q[i] = .5 * s;\n"
+        "    s = .5 / s;\n"
+        "    q[3] = (R[3*k+j] - R[3*j+k]) * s;\n"
+        "    q[j] = (R[3*j+i] + R[3*i+j]) * s;\n"
+        "    q[k] = (R[3*k+i] + R[3*i+k]) * s;\n"
+        "  }\n"
+        "}\n\n";
+
+      std::string cacheDirectory ()
+      {
+        const char* env (std::getenv ("HPP_AGIMUS_KERNEL_CACHE"));
+        if (env) return env;
+        env = std::getenv ("XDG_CACHE_HOME");
+        if (env) return std::string (env) + "/hpp-agimus";
+        env = std::getenv ("HOME");
+        if (!env) {
+          const passwd* pw (::getpwuid (::getuid()));
+          if (pw) env = pw->pw_dir;
+        }
+        if (!env || env[0] == '\0')
+          throw std::runtime_error ("Could not find the home directory: set "
+              "HPP_AGIMUS_KERNEL_CACHE");
+        return std::string (env) + "/.cache/hpp-agimus";
+      }
+
+      /// Create the directory and its parents, accessible by the user
+      /// only, and check that nobody else can write in it.
+      void makeDirectories (const std::string& path)
+      {
+        for (std::size_t i = 1; i <= path.size(); ++i) {
+          if (i < path.size() && path[i] != '/') continue;
+          const std::string dir (path.substr (0, i));
+          if (::mkdir (dir.c_str(), 0700) != 0 && errno != EEXIST)
+            throw std::runtime_error ("Could not create directory " + dir);
+        }
+        struct stat st;
+        if (::lstat (path.c_str(), &st) != 0 || !S_ISDIR (st.st_mode))
+          throw std::runtime_error (path + " is not a directory");
+        if (st.st_uid != ::geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+          throw std::runtime_error ("Refusing to load libraries from " + path
+              + ": it must be owned by the user and not be writable by "
+              "others");
+      }
+
+      /// FNV-1a hash
+      unsigned long long hash (const std::string& s)
+      {
+        unsigned long long h (14695981039346656037ULL);
+        for (std::size_t i = 0; i < s.size(); ++i) {
+          h ^= (unsigned char) s[i];
+          h *= 1099511628211ULL;
+        }
+        return h;
+      }
+    }
+
+    bool KinematicsKernel::generate (const pinocchio::Model& model,
+        const std::vector<Target>& targets, std::string& code)
+    {
+      // Joints on which a target depends.
+      std::vector<bool> needed (model.njoints, false);
+      for (std::size_t i = 0; i < targets.size(); ++i)
+        for (pinocchio::JointIndex j = targets[i].joint; j > 0;
+            j = model.parents[j])
+          needed[j] = true;
+
+      Writer w;
+      std::vector<Placement> oMi (model.njoints);
+      std::vector<Motion> v (model.njoints);
+      for (int i = 0; i < 3; ++i)
+        v[0].linear[i] = v[0].angular[i] = Scalar (0);
+      for (pinocchio::JointIndex i = 1; i < (pinocchio::JointIndex) model.njoints; ++i) {
+        if (!needed[i]) continue;
+        JointKind kind;
+        Eigen::Vector3d axis;
+        if (!jointKind (model.joints[i], kind, axis)) return false;
+        w.os << "  // " << model.names[i] << '\n';
+        Placement Mj;
+        Motion vj;
+        jointMotion (w, model.joints[i], kind, axis, Mj, vj);
+        const Placement liMi (compose (w, Placement (model.jointPlacements[i]),
+              Mj));
+        const pinocchio::JointIndex parent (model.parents[i]);
+        oMi[i] = (parent == 0 ? liMi : compose (w, oMi[parent], liMi));
+        v[i] = (parent == 0 ? vj : add (w, actInv (w, liMi, v[parent]), vj));
+      }
+
+      std::ostringstream os;
+      os << "// Forward kinematics generated by hpp-agimus. Do not edit.\n"
+        "#include <cmath>\n\n" << quaternionFunction
+        << "extern \"C\" void hpp_agimus_kinematics (const double* q, "
+        "const double* v, double* out)\n{\n"
+        "  (void) q; (void) v;\n"
+        << w.os.str();
+      for (std::size_t k = 0; k < targets.size(); ++k) {
+        Writer t;
+        const Placement fP (targets[k].placement);
+        const Placement oMf (compose (t, oMi[targets[k].joint], fP));
+        const Motion vf (actInv (t, fP, v[targets[k].joint]));
+        const std::size_t o (k * targetSize);
+        os << "  {\n" << t.os.str();
+        for (int i = 0; i < 3; ++i)
+          os << "  out[" << o+i << "] = " << expression (oMf.p[i]) << ";\n";
+        os << "  const double R[9] = {";
+        for (int i = 0; i < 9; ++i)
+          os << (i > 0 ? ", " : " ") << expression (oMf.R[i/3][i%3]);
+        os << " };\n  quaternion (R, out + " << o+3 << ");\n";
+        for (int i = 0; i < 3; ++i)
+          os << "  out[" << o+7+i << "] = " << expression (vf.linear[i]) << ";\n";
+        for (int i = 0; i < 3; ++i)
+          os << "  out[" << o+10+i << "] = " << expression (vf.angular[i]) << ";\n";
+        os << "  }\n";
+      }
+      os << "}\n";
+      code = os.str();
+      return true;
+    }
+
+    KinematicsKernelPtr_t KinematicsKernel::create
+    (const pinocchio::Model& model, const std::vector<Target>& targets)
+    {
+      std::string code;
+      if (!generate (model, targets, code)) return KinematicsKernelPtr_t();
+
+      const char* cxx (std::getenv ("HPP_AGIMUS_CXX"));
+      if (!cxx) cxx = std::getenv ("CXX");
+      if (!cxx) cxx = "c++";
+      const std::string flags ("-O3 -shared -fPIC");
+
+      const std::string dir (cacheDirectory());
+      makeDirectories (dir);
+      std::ostringstream base;
+      // A library compiled by another compiler or with other flags is not
+      // reused.
+      base << dir << "/kinematics-" << std::hex
+        << hash (std::string (cxx) + '\n' + flags + '\n' + code);
+      const std::string library (base.str() + ".so");
+      if (::access (library.c_str(), R_OK) != 0) {
+        // Write and compile in temporary files so that concurrent processes
+        // neither overwrite the source of another one nor load an
+        // incomplete library.
+        std::ostringstream pid;
+        pid << '.' << ::getpid();
+        const std::string source (base.str() + pid.str() + ".cc"),
+              tmp (library + pid.str());
+        {
+          std::ofstream file (source.c_str());
+          file << code;
+          if (!file.good())
+            throw std::runtime_error ("Could not write " + source);
+        }
+        const std::string command (std::string (cxx) + ' ' + flags + " -o '"
+            + tmp + "' '" + source + "'");
+        const int status (std::system (command.c_str()));
+        std::remove (source.c_str());
+        if (status != 0) {
+          std::remove (tmp.c_str());
+          throw std::runtime_error ("Could not compile the kinematics: "
+              + command);
+        }
+        if (std::rename (tmp.c_str(), library.c_str()) != 0)
+          throw std::runtime_error ("Could not create " + library);
+      }
+
+      shared_ptr<KinematicsKernel> kernel (new KinematicsKernel (targets));
+      kernel->library_ = ::dlopen (library.c_str(), RTLD_NOW | RTLD_LOCAL);
+      if (!kernel->library_)
+        throw std::runtime_error ("Could not load " + library + ": "
+            + ::dlerror());
+      kernel->function_ = (Function_t) ::dlsym (kernel->library_,
+          "hpp_agimus_kinematics");
+      if (!kernel->function_)
+        throw std::runtime_error ("Invalid kinematics library " + library);
+      kernel->check (model);
+      return kernel;
+    }
+
+    KinematicsKernel::~KinematicsKernel ()
+    {
+      if (library_) ::dlclose (library_);
+    }
+
+    void KinematicsKernel::check (const pinocchio::Model& model) const
+    {
+      ::pinocchio::Data data (model);
+      const Eigen::VectorXd q0 (::pinocchio::neutral (model));
+      Eigen::VectorXd q (model.nq), v (model.nv), dq (model.nv);
+      std::vector<value_type> out (outputSize());
+      value_type error (0);
+      for (int trial = 0; trial < 3; ++trial) {
+        dq.setRandom();
+        v.setRandom();
+        ::pinocchio::integrate (model, q0, dq, q);
+        ::pinocchio::forwardKinematics (model, data, q, v);
+        compute (q.data(), v.data(), out.data());
+        for (std::size_t k = 0; k < targets_.size(); ++k) {
+          const Target& t (targets_[k]);
+          const value_type* o (&out[k * targetSize]);
+          const pinocchio::SE3 M (data.oMi[t.joint] * t.placement);
+          const Eigen::Vector4d quat (Eigen::Quaterniond (M.rotation())
+              .coeffs());
+          const Eigen::Map<const Eigen::Vector4d> generated (o+3);
+          error = std::max (error, (M.translation()
+                - Eigen::Map<const Eigen::Vector3d> (o)).norm());
+          error = std::max (error, std::min ((quat - generated).norm(),
+                (quat + generated).norm()));
+          error = std::max (error, (t.placement.actInv (data.v[t.joint])
+                .toVector() - Eigen::Map<const Eigen::Matrix<value_type, 6, 1> >
+                (o+7)).norm());
+        }
+      }
+      if (error > 1e-8) {
+        std::ostringstream os;
+        os << "The generated kinematics differ from pinocchio (error is "
+          << error << ")";
+        throw std::runtime_error (os.str());
+      }
+    }
+  } // namespace agimus
+} // namespace hpp
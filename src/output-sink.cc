@@ -0,0 +1,298 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <hpp/agimus/output-sink.hh>
+
+#include <limits>
+#include <stdexcept>
+
+#include <geometry_msgs/Transform.h>
+#include <geometry_msgs/Vector3.h>
+#include <dynamic_graph_bridge_msgs/Vector.h>
+#include <dynamic_graph_bridge_msgs/Matrix.h>
+
+namespace hpp {
+  namespace agimus {
+    static const uint32_t queue_size = 1000;
+
+    // ------------------------------------------------------------------ //
+    // RosSink
+
+    RosSink::~RosSink ()
+    {
+      resetChannels();
+    }
+
+    void RosSink::addChannel (ChannelIndex index, const std::string& name,
+        ChannelType type)
+    {
+      if (index >= channels_.size()) channels_.resize (index+1);
+      Channel& channel (channels_[index]);
+      channel.type = type;
+      channel.written = false;
+      const std::string topic (prefix_ + name);
+      switch (type) {
+        case VectorChannel:
+          channel.pub = handle_.advertise <dynamic_graph_bridge_msgs::Vector>
+            (topic, queue_size, false);
+          break;
+        case Vector3Channel:
+          channel.pub = handle_.advertise <geometry_msgs::Vector3>
+            (topic, queue_size, false);
+          channel.value.resize (3);
+          break;
+        case TransformChannel:
+          channel.pub = handle_.advertise <geometry_msgs::Transform>
+            (topic, queue_size, false);
+          channel.value.resize (7);
+          break;
+        case MatrixChannel:
+          channel.pub = handle_.advertise <dynamic_graph_bridge_msgs::Matrix>
+            (topic, queue_size, false);
+          break;
+      }
+    }
+
+    void RosSink::resetChannels ()
+    {
+      for (std::size_t i = 0; i < channels_.size(); ++i)
+        channels_[i].pub.shutdown();
+      channels_.clear();
+    }
+
+    void RosSink::beginTick (std::size_t, value_type)
+    {
+      for (std::size_t i = 0; i < channels_.size(); ++i)
+        channels_[i].written = false;
+    }
+
+    void RosSink::write (ChannelIndex index, vectorIn_t value)
+    {
+      assert (index < channels_.size());
+      Channel& channel (channels_[index]);
+      channel.value = value;
+      channel.written = true;
+    }
+
+    void RosSink::writeMatrix (ChannelIndex index, matrixIn_t value)
+    {
+      assert (index < channels_.size());
+      Channel& channel (channels_[index]);
+      channel.matrix = value;
+      channel.written = true;
+    }
+
+    void RosSink::commitTick ()
+    {
+      for (std::size_t i = 0; i < channels_.size(); ++i) {
+        Channel& channel (channels_[i]);
+        if (!channel.written) continue;
+        const vector_t& v (channel.value);
+        switch (channel.type) {
+          case VectorChannel:
+            {
+              dynamic_graph_bridge_msgs::Vector msg;
+              msg.data.assign (v.data(), v.data() + v.size());
+              channel.pub.publish (msg);
+            }
+            break;
+          case Vector3Channel:
+            {
+              geometry_msgs::Vector3 msg;
+              msg.x = v[0];
+              msg.y = v[1];
+              msg.z = v[2];
+              channel.pub.publish (msg);
+            }
+            break;
+          case TransformChannel:
+            {
+              geometry_msgs::Transform msg;
+              msg.translation.x = v[0];
+              msg.translation.y = v[1];
+              msg.translation.z = v[2];
+              msg.rotation.x = v[3];
+              msg.rotation.y = v[4];
+              msg.rotation.z = v[5];
+              msg.rotation.w = v[6];
+              channel.pub.publish (msg);
+            }
+            break;
+          case MatrixChannel:
+            {
+              const matrix_t& m (channel.matrix);
+              dynamic_graph_bridge_msgs::Matrix msg;
+              msg.width = (int) m.cols();
+              msg.data.resize (m.size());
+              Eigen::Map<Eigen::Matrix<value_type, Eigen::Dynamic,
+                Eigen::Dynamic, Eigen::RowMajor> >
+                (msg.data.data(), m.rows(), m.cols()) = m;
+              channel.pub.publish (msg);
+            }
+            break;
+        }
+        channel.written = false;
+      }
+    }
+
+    // ------------------------------------------------------------------ //
+    // MemorySink
+
+    void MemorySink::addChannel (ChannelIndex index, const std::string& name,
+        ChannelType)
+    {
+      if (index >= channels_.size()) channels_.resize (index+1);
+      channels_[index].name = name;
+      channels_[index].values.clear();
+      channels_[index].ticks.clear();
+      channels_[index].nbCommitted = 0;
+    }
+
+    void MemorySink::resetChannels ()
+    {
+      channels_.clear();
+    }
+
+    void MemorySink::beginTick (std::size_t tick, value_type time)
+    {
+      tick_ = tick;
+      time_ = time;
+      // Discard the values of a tick that was not committed.
+      for (std::size_t i = 0; i < channels_.size(); ++i) {
+        channels_[i].values.resize (channels_[i].nbCommitted);
+        channels_[i].ticks.resize (channels_[i].nbCommitted);
+      }
+    }
+
+    void MemorySink::write (ChannelIndex index, vectorIn_t value)
+    {
+      assert (index < channels_.size());
+      channels_[index].values.push_back (value);
+      channels_[index].ticks.push_back (tick_);
+    }
+
+    void MemorySink::writeMatrix (ChannelIndex index, matrixIn_t value)
+    {
+      assert (index < channels_.size());
+      vector_t v (value.size());
+      Eigen::Map<Eigen::Matrix<value_type, Eigen::Dynamic, Eigen::Dynamic,
+        Eigen::RowMajor> > (v.data(), value.rows(), value.cols()) = value;
+      channels_[index].values.push_back (v);
+      channels_[index].ticks.push_back (tick_);
+    }
+
+    void MemorySink::commitTick ()
+    {
+      ticks_.push_back (tick_);
+      times_.push_back (time_);
+      for (std::size_t i = 0; i < channels_.size(); ++i)
+        channels_[i].nbCommitted = channels_[i].values.size();
+    }
+
+    void MemorySink::clear ()
+    {
+      ticks_.clear();
+      times_.clear();
+      for (std::size_t i = 0; i < channels_.size(); ++i) {
+        channels_[i].values.clear();
+        channels_[i].ticks.clear();
+        channels_[i].nbCommitted = 0;
+      }
+    }
+
+    const MemorySink::Channel& MemorySink::channel (const std::string& name)
+      const
+    {
+      for (std::size_t i = 0; i < channels_.size(); ++i)
+        if (channels_[i].name == name) return channels_[i];
+      throw std::invalid_argument ("No channel " + name);
+    }
+
+    const std::vector<vector_t>& MemorySink::values (const std::string& name)
+      const
+    {
+      return channel (name).values;
+    }
+
+    const std::vector<std::size_t>& MemorySink::valueTicks
+      (const std::string& name) const
+    {
+      return channel (name).ticks;
+    }
+
+    // ------------------------------------------------------------------ //
+    // FileSink
+
+    FileSinkPtr_t FileSink::create (const std::string& filename)
+    {
+      FileSinkPtr_t ptr (new FileSink);
+      ptr->file_.open (filename.c_str());
+      if (!ptr->file_.is_open())
+        throw std::runtime_error ("Could not open file " + filename);
+      ptr->tick_.precision (std::numeric_limits<value_type>::digits10 + 2);
+      return ptr;
+    }
+
+    void FileSink::addChannel (ChannelIndex index, const std::string& name,
+        ChannelType type)
+    {
+      file_ << "# " << index << ' ' << name << ' ' << type << '\n';
+    }
+
+    void FileSink::resetChannels ()
+    {
+      file_ << "# reset\n";
+    }
+
+    void FileSink::beginTick (std::size_t tick, value_type time)
+    {
+      tickIndex_ = tick;
+      time_ = time;
+      tick_.str ("");
+    }
+
+    void FileSink::write (ChannelIndex index, vectorIn_t value)
+    {
+      tick_ << tickIndex_ << ' ' << time_ << ' ' << index;
+      for (vector_t::Index i = 0; i < value.size(); ++i)
+        tick_ << ' ' << value[i];
+      tick_ << '\n';
+    }
+
+    void FileSink::writeMatrix (ChannelIndex index, matrixIn_t value)
+    {
+      for (matrix_t::Index i = 0; i < value.rows(); ++i)
+        write (index, value.row(i).transpose());
+    }
+
+    void FileSink::commitTick ()
+    {
+      file_ << tick_.str();
+    }
+  } // namespace agimus
+} // namespace hpp
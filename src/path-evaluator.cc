@@ -0,0 +1,167 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <hpp/agimus/path-evaluator.hh>
+
+#include <algorithm>
+
+#include <hpp/pinocchio/configuration.hh>
+#include <hpp/pinocchio/liegroup.hh>
+#include <hpp/core/path-vector.hh>
+#include <hpp/core/straight-path.hh>
+#include <hpp/core/interpolated-path.hh>
+
+namespace hpp {
+  namespace agimus {
+    // StraightPath and InterpolatedPath interpolate on this Lie group, so
+    // that the fused evaluation gives the same configurations.
+    typedef pinocchio::RnxSOnLieGroupMap LieGroup_t;
+
+    void PathEvaluator::path (const PathPtr_t& path, const DevicePtr_t& device,
+        bool fused)
+    {
+      if (path == path_ && device == device_ && fused == fused_) return;
+      path_ = path;
+      device_ = device;
+      fused_ = fused;
+      leaves_.clear();
+      rank_ = 0;
+      dq_.resize (device_->numberDof());
+
+      core::PathVectorPtr_t pv (HPP_DYNAMIC_PTR_CAST (core::PathVector, path));
+      // The time parameterization of a path vector applies to all its
+      // sub-paths and cannot be flattened.
+      if (!pv || pv->timeParameterization()) {
+        addLeaf (path, path->timeRange().first);
+        return;
+      }
+      core::PathVectorPtr_t flat (core::PathVector::create
+          (pv->outputSize(), pv->outputDerivativeSize()));
+      pv->flatten (flat);
+      value_type start (pv->timeRange().first);
+      for (std::size_t i = 0; i < flat->numberPaths(); ++i) {
+        const PathPtr_t& p (flat->pathAtRank (i));
+        addLeaf (p, start);
+        start += p->length();
+      }
+      if (leaves_.empty()) addLeaf (path, path->timeRange().first);
+    }
+
+    void PathEvaluator::addLeaf (const PathPtr_t& path, value_type start)
+    {
+      leaves_.push_back (Leaf());
+      Leaf& leaf (leaves_.back());
+      leaf.path = path;
+      leaf.kind = Generic;
+      leaf.start = start;
+      if (!fused_ || path->constraints() || path->timeParameterization())
+        return;
+
+      core::StraightPathPtr_t straight
+        (HPP_DYNAMIC_PTR_CAST (core::StraightPath, path));
+      if (straight) {
+        leaf.kind = Straight;
+        leaf.initial = straight->initial();
+        leaf.velocity.resize (device_->numberDof());
+        if (straight->length() > 0) {
+          pinocchio::difference<LieGroup_t> (device_, straight->end(),
+              leaf.initial, leaf.velocity);
+          leaf.velocity /= straight->length();
+        } else
+          leaf.velocity.setZero();
+        return;
+      }
+      leaf.interpolated = HPP_DYNAMIC_PTR_CAST (core::InterpolatedPath, path);
+      if (leaf.interpolated && leaf.interpolated->interpolationPoints().size() > 1)
+        leaf.kind = Interpolated;
+    }
+
+    bool PathEvaluator::operator() (value_type time, ConfigurationOut_t q,
+        vectorOut_t v)
+    {
+      assert (!leaves_.empty());
+      // Times are usually increasing: start from the previous sub-path.
+      while (rank_ + 1 < leaves_.size() && time >= leaves_[rank_+1].start)
+        ++rank_;
+      while (rank_ > 0 && time < leaves_[rank_].start)
+        --rank_;
+      const Leaf& leaf (leaves_[rank_]);
+      const core::interval_t& range (leaf.path->timeRange());
+      const value_type s (std::min (range.second, std::max (range.first,
+              time - leaf.start + range.first)));
+      s_ = s;
+
+      switch (leaf.kind) {
+        case Straight:
+          dq_.noalias() = (s - range.first) * leaf.velocity;
+          pinocchio::integrate<false, LieGroup_t> (device_, leaf.initial, dq_,
+              q);
+          v = leaf.velocity;
+          return true;
+        case Interpolated:
+          {
+            typedef core::InterpolatedPath::InterpolationPoints_t Points_t;
+            const Points_t& points (leaf.interpolated->interpolationPoints());
+            Points_t::const_iterator next (points.lower_bound (s));
+            if (next == points.begin()) ++next;
+            if (next == points.end()) --next;
+            Points_t::const_iterator prev (next);
+            --prev;
+            const value_type T (next->first - prev->first);
+            if (T > 0) {
+              pinocchio::difference<LieGroup_t> (device_, next->second,
+                  prev->second, v);
+              v /= T;
+              dq_.noalias() = (s - prev->first) * v;
+              pinocchio::integrate<false, LieGroup_t> (device_, prev->second,
+                  dq_, q);
+            } else {
+              q = prev->second;
+              v.setZero();
+            }
+          }
+          return true;
+        case Generic:
+          break;
+      }
+      if (!leaf.path->eval (q, s)) return false;
+      leaf.path->derivative (v, s, 1);
+      return true;
+    }
+
+    void PathEvaluator::acceleration (vectorOut_t a)
+    {
+      const Leaf& leaf (leaves_[rank_]);
+      if (leaf.kind == Generic)
+        leaf.path->derivative (a, s_, 2);
+      else
+        a.setZero();
+    }
+  } // namespace agimus
+} // namespace hpp
@@ -27,19 +27,30 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
 // OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include <hpp/util/debug.hh>
 
+#include <boost/bind.hpp>
 #include <boost/format.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread/thread.hpp>
 #include <hpp/agimus/point-cloud.hh>
+#include <hpp/agimus/discretization.hh>
 
 #include <ros/node_handle.h>
 
+#include <pinocchio/macros.hpp>
 #include <pinocchio/spatial/se3.hpp>
 #include <pinocchio/multibody/fcl.hpp>
+#include <pinocchio/multibody/model.hpp>
 #include <pinocchio/multibody/geometry.hpp>
 
 #include <hpp/fcl/octree.h>
 
+#include <hpp/pinocchio/device-sync.hh>
 #include <hpp/pinocchio/joint.hh>
 
 #include <hpp/core/problem.hh>
@@ -59,6 +70,7 @@ namespace hpp {
 
     PointCloud::~PointCloud()
     {
+      stopPool();
       shutdownRos();
     }
 
@@ -95,9 +107,13 @@ namespace hpp {
     {
       if (!handle_)
         throw std::logic_error ("Initialize ROS first");
+      if (octreeFrame != octreeFrame_) octomap_.reset();
       octreeFrame_ = octreeFrame;
       sensorFrame_ = sensorFrame;
       newPointCloud_ = newPointCloud;
+      resolution_ = resolution;
+      // The points are expressed in octreeFrame as they are received.
+      computeSensorPose(octreeFrame, sensorFrame, configuration);
       // create subscriber to topic
       waitingForData_ = false;
       ros::Subscriber subscriber = handle_->subscribe
@@ -119,12 +135,23 @@ namespace hpp {
         ROS_ERROR_STREAM("Timeout reached while waiting for topic " << topic);
         return false;
       }
-      // Express point cloud in octreeFrame frame
-      movePointCloud(octreeFrame, sensorFrame, configuration);
-
-      // build octree
-      hpp::fcl::OcTreePtr_t octree(hpp::fcl::makeOctree(pointsInLinkFrame_,
-							resolution));
+      // Insert the new points in the octree. The points of the previous
+      // views are kept unless the point cloud is new. The octree of the
+      // previous views may be used by the geometry of the robot, that the
+      // collision monitor of Discretization tests while holding the
+      // geometry mutex: the points are inserted while holding it too.
+      {
+        boost::mutex::scoped_lock lock (Discretization::geometryMutex());
+        if (newPointCloud_ || !octomap_ ||
+            octomap_->getResolution() != resolution)
+          octomap_.reset(new octomap::OcTree(resolution));
+        for (size_type i=0; i < pointsInLinkFrame_.rows(); ++i)
+          octomap_->updateNode(pointsInLinkFrame_(i, 0),
+                               pointsInLinkFrame_(i, 1),
+                               pointsInLinkFrame_(i, 2), true, true);
+        octomap_->updateInnerOccupancy();
+      }
+      OcTreePtr_t octree(new hpp::fcl::OcTree(octomap_));
       attachOctreeToRobot(octree, octreeFrame);
       return true;
     }
@@ -133,11 +160,16 @@ namespace hpp {
     {
       std::string name(octreeFrame + std::string("/octree"));
       const DevicePtr_t& robot (problemSolver_->robot());
-      // Remove octree from pinocchio model
-      if (robot->geomModel().existGeometryName(name)) {
-        robot->geomModel().removeGeometryObject(name);
-      } else return;
-      robot->createGeomData();
+      if (octreeFrame == octreeFrame_) octomap_.reset();
+      {
+        boost::mutex::scoped_lock lock (Discretization::geometryMutex());
+        // Remove octree from pinocchio model
+        if (robot->geomModel().existGeometryName(name)) {
+          robot->geomModel().removeGeometryObject(name);
+        } else return;
+        robot->createGeomData();
+        Discretization::geometryChanged();
+      }
       // Invalidate constraint graph to force reinitialization before using
       // PathValidation instances stored in the edges.
       manipulation::graph::GraphPtr_t graph(problemSolver_->constraintGraph());
@@ -157,6 +189,30 @@ namespace hpp {
       minDistance_ = min; maxDistance_ = max;
     }
 
+    void PointCloud::setVoxelSize(value_type size)
+    {
+      voxelSize_ = size;
+    }
+
+    value_type PointCloud::voxelGridSize() const
+    {
+      return (voxelSize_ == 0 ? resolution_ : voxelSize_);
+    }
+
+    void PointCloud::setNumberOfThreads(size_type n)
+    {
+      if (n <= 0)
+        throw std::invalid_argument("The number of threads must be positive");
+      nbThreads_ = n;
+    }
+
+    void PointCloud::setCollisionFilter(const std::vector<std::string>& allow,
+                                        const std::vector<std::string>& deny)
+    {
+      collisionAllow_ = allow;
+      collisionDeny_ = deny;
+    }
+
     void PointCloud::setDisplay(bool flag)
     {
       display_ = flag;
@@ -190,91 +246,380 @@ namespace hpp {
 	   << fields[2].name << "\".";
 	throw std::invalid_argument(os.str());
       }
+      // Check that x, y, and z are stored as float
+      for (std::size_t i=0; i<3; ++i) {
+	if (fields[i].datatype != sensor_msgs::PointField::FLOAT32){
+	  std::ostringstream os;
+	  os << "Wrong type of field \"" << fields[i].name
+	     << "\". Expected FLOAT32, got " << (int)fields[i].datatype << ".";
+	  throw std::invalid_argument(os.str());
+	}
+      }
     }
 
-    bool PointCloud::filterPoint(uint32_t pointcloud_id, uint32_t point_id)
-    {
-      // Keep point only if included in distance interval
-      value_type m2(minDistance_*minDistance_);
-      value_type M2(maxDistance_*maxDistance_);
-      if ((m2 > pointsInSensorFrame_[pointcloud_id].row(point_id).squaredNorm())
-          || (pointsInSensorFrame_[pointcloud_id].row(point_id).squaredNorm() > M2)) {
-            return false;
-      }
-      if (filterBehindPlan_)
+    namespace {
+      /// Number of points filtered together.
+      const int blockSize = 64;
+      /// Minimal number of points processed by each thread.
+      const size_type minPointsPerThread = 1 << 15;
+
+      /// Filter and transformation of the points of a point cloud.
+      ///
+      /// The points are processed by blocks of coordinates so that the
+      /// tests and the transformation are vectorized.
+      template <typename Scalar>
+      struct PointFilter
+      {
+        typedef Eigen::Array<Scalar, blockSize, 1> Block_t;
+        typedef Eigen::Array<bool, blockSize, 1> Mask_t;
+        typedef Eigen::Matrix<Scalar, 3, 1> Vector3_t;
+        typedef typename PointMatrix<Scalar>::type Points_t;
+
+        /// Bounds of the squared distance to the sensor
+        Scalar m2, M2;
+        /// Object plan in the sensor frame. The normal is zero and the
+        /// margin is -infinity when the plan is not used.
+        Vector3_t planePoint, planeNormal;
+        Scalar margin;
+        /// Pose of the sensor in the link holding the octree
+        Eigen::Matrix<Scalar, 3, 3> R;
+        Vector3_t t;
+
+        /// Filter the first n points of a block and write the ones that
+        /// are kept, in the link frame, from row iPoint of points.
+        /// Points with a NaN coordinate are rejected as all the tests fail.
+        /// \return the index of the row following the last written point.
+        size_type operator() (const Block_t& X, const Block_t& Y,
+                              const Block_t& Z, int n, Points_t& points,
+                              size_type iPoint) const
+        {
+          const Block_t d2(X*X + Y*Y + Z*Z);
+          const Block_t h((X - planePoint[0]) * planeNormal[0] +
+                          (Y - planePoint[1]) * planeNormal[1] +
+                          (Z - planePoint[2]) * planeNormal[2]);
+          const Mask_t keep((d2 >= m2) && (d2 <= M2) && (h >= margin));
+          const Block_t LX(R(0,0)*X + R(0,1)*Y + R(0,2)*Z + t[0]);
+          const Block_t LY(R(1,0)*X + R(1,1)*Y + R(1,2)*Z + t[1]);
+          const Block_t LZ(R(2,0)*X + R(2,1)*Y + R(2,2)*Z + t[2]);
+          for (int i=0; i < n; ++i) {
+            if (!keep[i]) continue;
+            points(iPoint, 0) = LX[i];
+            points(iPoint, 1) = LY[i];
+            points(iPoint, 2) = LZ[i];
+            ++iPoint;
+          }
+          return iPoint;
+        }
+      };
+
+      /// Coordinates of the points of a message, read in place.
+      typedef Eigen::Map<const PointMatrix<float>::type, Eigen::Unaligned,
+                         Eigen::OuterStride<> > PointMap_t;
+
+      /// Whether the coordinates can be read through a PointMap_t: x, y
+      /// and z are consecutive floats and the rows are not padded.
+      bool hasDenseLayout(const sensor_msgs::PointCloud2& data)
       {
-        // Keep point only if in front of the object
-        const DevicePtr_t& robot (problemSolver_->robot());
-        if(!robot){
-          throw std::logic_error
-            ("There is no robot in the ProblemSolver instance");
+        const std::vector<sensor_msgs::PointField>& fields(data.fields);
+        return fields[1].offset == fields[0].offset + sizeof(float)
+          && fields[2].offset == fields[0].offset + 2*sizeof(float)
+          && fields[0].offset % sizeof(float) == 0
+          && data.point_step % sizeof(float) == 0
+          && (data.height <= 1 || data.row_step == data.width * data.point_step);
+      }
+
+      /// Set of voxels, by open addressing with linear probing.
+      class VoxelSet
+      {
+      public:
+        /// \param n maximal number of voxels
+        explicit VoxelSet(size_type n) : mask_(15)
+        {
+          while (mask_ + 1 < 2 * (std::size_t)n) mask_ = 2 * mask_ + 1;
+          keys_.assign(mask_ + 1, 0);
         }
-        Frame of(robot->getFrameByName(octreeFrame_)); // object frame
-        Transform3f wMo(of.currentTransformation());
-        Frame cf(robot->getFrameByName(sensorFrame_)); // camera_frame
-        Transform3f wMc(cf.currentTransformation());
-        vector3_t wP = wMo.actOnEigenObject(plaquePoint_); // plan point in world frame
-        vector3_t cP = wMc.inverse().actOnEigenObject(wP); // plan point in camera frame
-        vector3_t wNormal = wMo.rotation()  * plaqueNormalVector_; // plan normal in world frame
-        vector3_t cNormal = wMc.inverse().rotation() * wNormal; // plan normal in camera frame
-        vector3_t tmp(pointsInSensorFrame_[pointcloud_id].row(point_id));
-        vector3_t to_point = tmp - cP;
-        if (to_point.dot(cNormal)
-            < objectPlanMargin_) {
-          return false;
+        /// \return false if the voxel was already in the set.
+        bool insert(uint64_t key)
+        {
+          // 0 marks the empty slots.
+          ++key;
+          uint64_t h(key);
+          h ^= h >> 33; h *= 0xff51afd7ed558ccdULL; h ^= h >> 33;
+          for (std::size_t i = h & mask_; ; i = (i + 1) & mask_) {
+            if (keys_[i] == key) return false;
+            if (keys_[i] == 0) {
+              keys_[i] = key;
+              return true;
+            }
+          }
         }
+      private:
+        std::size_t mask_;
+        std::vector<uint64_t> keys_;
+      };
+
+      /// Keep the first point of each voxel among rows [begin, end) of
+      /// points, and move them to the beginning of the range.
+      /// \return the number of points kept.
+      template <typename Scalar>
+      size_type voxelGrid(typename PointMatrix<Scalar>::type& points,
+                          size_type begin, size_type end, value_type size)
+      {
+        // The indices of a voxel are packed in 21 bits each. Points out of
+        // this range are all kept.
+        static const int64_t bits = 21, range = int64_t(1) << (bits-1);
+        const value_type inverse(1 / size);
+        VoxelSet voxels(end - begin);
+        size_type kept = begin;
+        for (size_type i=begin; i < end; ++i) {
+          uint64_t key = 0;
+          bool inRange = true;
+          for (int j=0; inRange && j < 3; ++j) {
+            const value_type k(std::floor(points(i, j) * inverse));
+            inRange = (k >= -range && k < range);
+            if (inRange) key = (key << bits) | (uint64_t)((int64_t)k + range);
+          }
+          if (inRange && !voxels.insert(key)) continue;
+          if (kept != i) points.row(kept) = points.row(i);
+          ++kept;
+        }
+        return kept - begin;
       }
-      return true;
-    }
+
+      /// Filter the points [begin, end) of a message, the points being
+      /// numbered row after row.
+      template <typename Scalar>
+      struct Worker
+      {
+        typedef PointFilter<Scalar> Filter_t;
+        typedef typename Filter_t::Block_t Block_t;
+        typedef typename Filter_t::Points_t Points_t;
+
+        const sensor_msgs::PointCloud2* data;
+        const Filter_t* filter;
+        size_type begin, end;
+        /// Size of the voxels of the grid, or non positive.
+        value_type voxelSize;
+        /// Output: the kept points are written from row first.
+        Points_t* points;
+        size_type first;
+        /// Number of points kept.
+        size_type count;
+
+        void operator() ()
+        {
+          const sensor_msgs::PointCloud2& msg(*data);
+          const uint32_t offsetX(msg.fields[0].offset),
+            offsetY(msg.fields[1].offset), offsetZ(msg.fields[2].offset);
+          Block_t X(Block_t::Zero()), Y(Block_t::Zero()), Z(Block_t::Zero());
+          size_type iPoint = first;
+          if (hasDenseLayout(msg)) {
+            const PointMap_t cloud
+              ((const float*)(msg.data.data() + offsetX),
+               (size_type)msg.height * msg.width, 3,
+               Eigen::OuterStride<>(msg.point_step / sizeof(float)));
+            for (size_type k=begin; k < end; k+=blockSize) {
+              const int n ((int)std::min<size_type>(blockSize, end - k));
+              X.head(n) = cloud.col(0).segment(k, n).template cast<Scalar>();
+              Y.head(n) = cloud.col(1).segment(k, n).template cast<Scalar>();
+              Z.head(n) = cloud.col(2).segment(k, n).template cast<Scalar>();
+              iPoint = (*filter)(X, Y, Z, n, *points, iPoint);
+            }
+          } else {
+            uint32_t row ((uint32_t)(begin / msg.width)),
+              col ((uint32_t)(begin % msg.width));
+            const uint8_t* ptr = msg.data.data() + row * msg.row_step
+              + col * msg.point_step;
+            for (size_type k=begin; k < end; k+=blockSize) {
+              const int n ((int)std::min<size_type>(blockSize, end - k));
+              for (int i=0; i < n; ++i) {
+                X[i] = (Scalar)(*(const float*)(ptr+offsetX));
+                Y[i] = (Scalar)(*(const float*)(ptr+offsetY));
+                Z[i] = (Scalar)(*(const float*)(ptr+offsetZ));
+                ptr+=msg.point_step;
+                if (++col == msg.width) {
+                  col = 0; ++row;
+                  ptr = msg.data.data() + row * msg.row_step;
+                }
+              }
+              iPoint = (*filter)(X, Y, Z, n, *points, iPoint);
+            }
+          }
+          count = iPoint - first;
+          // Removing the duplicates of each range first keeps the first
+          // point of each voxel of the whole cloud.
+          if (voxelSize > 0)
+            count = voxelGrid<Scalar>(*points, first, iPoint, voxelSize);
+        }
+      };
+    } // namespace
 
     void PointCloud::pointCloudCb(const sensor_msgs::PointCloud2ConstPtr& data)
     {
       if (!waitingForData_) return;
       waitingForData_ = false;
-      checkFields(data->fields);
-
-      uint32_t pc_id = 0;
-      if (newPointCloud_) {
-        pointsInSensorFrame_.clear();
-      }
-      else {
-        pc_id = (uint32_t)pointsInSensorFrame_.size();
-      }
-      uint32_t iPoint = 0;
-      const uint8_t* ptr = &(data->data[0]);
-      pointsInSensorFrame_.push_back(PointMatrix_t ());
-      pointsInSensorFrame_[pc_id].resize(data->height * data->width, 3);
-
-      for (uint32_t row=0; row < data->height; ++row) {
-        for (uint32_t col=0; col < data->width; ++col) {
-          pointsInSensorFrame_[pc_id](iPoint, 0) = (double)(*(const float*)
-                (ptr+data->fields[0].offset));
-          pointsInSensorFrame_[pc_id](iPoint, 1) = (double)(*(const float*)
-                (ptr+data->fields[1].offset));
-          pointsInSensorFrame_[pc_id](iPoint, 2) = (double)(*(const float*)
-                (ptr+data->fields[2].offset));
-          // Keep only wanted points
-          if (filterPoint(pc_id, iPoint))
-            ++iPoint;
-          ptr+=data->point_step;
+      // The points of the previous views are already in the octree.
+      filterPoints(*data, pointsInLinkFrame_);
+    }
+
+    void PointCloud::filterPoints(const sensor_msgs::PointCloud2& data,
+                                  Points_t& points)
+    {
+      checkFields(data.fields);
+
+      typedef PointFilter<PointScalar> Filter_t;
+      Filter_t filter;
+      filter.m2 = (PointScalar)(minDistance_*minDistance_);
+      filter.M2 = (PointScalar)(maxDistance_*maxDistance_);
+      if (filterBehindPlan_) {
+        filter.planePoint = planePoint_.cast<PointScalar>();
+        filter.planeNormal = planeNormal_.cast<PointScalar>();
+        filter.margin = (PointScalar)objectPlanMargin_;
+      } else {
+        filter.planePoint.setZero();
+        filter.planeNormal.setZero();
+        filter.margin = -std::numeric_limits<PointScalar>::infinity();
+      }
+      filter.R = linkMsensor_.rotation().cast<PointScalar>();
+      filter.t = linkMsensor_.translation().cast<PointScalar>();
+
+      // Split the points in ranges processed in parallel. Each thread
+      // writes in its own matrix, except the first one that writes
+      // directly in points.
+      const size_type nbPoints ((size_type)data.height * data.width);
+      const size_type nbThreads (std::max<size_type>(1, std::min<size_type>
+            (nbThreads_, nbPoints / minPointsPerThread)));
+      const size_type chunk ((nbPoints + nbThreads - 1) / nbThreads);
+      std::vector<Worker<PointScalar> > workers(nbThreads);
+      std::vector<Points_t> blocks(nbThreads - 1);
+      std::vector<boost::function<void()> > tasks(nbThreads);
+      points.resize(std::min(chunk, nbPoints), 3);
+      for (size_type i=0; i < nbThreads; ++i) {
+        Worker<PointScalar>& w(workers[i]);
+        w.data = &data;
+        w.filter = &filter;
+        w.begin = std::min(i * chunk, nbPoints);
+        w.end = std::min(w.begin + chunk, nbPoints);
+        w.voxelSize = voxelGridSize();
+        if (i == 0) {
+          w.points = &points;
+          w.first = 0;
+        } else {
+          blocks[i-1].resize(w.end - w.begin, 3);
+          w.points = &blocks[i-1];
+          w.first = 0;
         }
+        tasks[i] = boost::ref(w);
+      }
+      runTasks(tasks);
+
+      // Concatenate the points kept by each thread, in order.
+      size_type iPoint(workers[0].count);
+      size_type total(iPoint);
+      for (size_type i=1; i < nbThreads; ++i) total += workers[i].count;
+      points.conservativeResize(total, 3);
+      for (size_type i=1; i < nbThreads; ++i) {
+        const size_type n(workers[i].count);
+        points.middleRows(iPoint, n) = blocks[i-1].topRows(n);
+        iPoint += n;
+      }
+      // Keep one point per voxel of the whole point cloud. As the voxels
+      // are the leaves of the octree when the sizes are equal, the octree
+      // is the same.
+      if (voxelGridSize() > 0)
+        voxelGridFilter<PointScalar>(points, voxelGridSize());
+    }
+
+    void PointCloud::runTasks
+    (const std::vector<boost::function<void()> >& tasks)
+    {
+      // The pool is rebuilt only when the number of threads changes.
+      if (pool_.size() + 1 != (std::size_t)nbThreads_) {
+        stopPool();
+        poolStop_ = false;
+        for (std::size_t i=1; i < (std::size_t)nbThreads_; ++i)
+          pool_.push_back(shared_ptr<boost::thread>(new boost::thread
+                (boost::bind(&PointCloud::poolThread, this, i,
+                             poolGeneration_))));
+      }
+      {
+        boost::mutex::scoped_lock lock(poolMutex_);
+        tasks_ = tasks;
+        poolPending_ = (size_type)tasks.size() - 1;
+        ++poolGeneration_;
+      }
+      if (tasks.size() > 1) poolWork_.notify_all();
+      tasks[0]();
+      boost::mutex::scoped_lock lock(poolMutex_);
+      while (poolPending_ > 0) poolDone_.wait(lock);
+      tasks_.clear();
+    }
+
+    void PointCloud::poolThread(std::size_t index, size_type generation)
+    {
+      boost::mutex::scoped_lock lock(poolMutex_);
+      while (true) {
+        while (!poolStop_ && poolGeneration_ == generation)
+          poolWork_.wait(lock);
+        if (poolStop_) return;
+        // A batch cannot start before the tasks of the previous one are
+        // completed, so a thread with a task never misses its batch.
+        generation = poolGeneration_;
+        if (index >= tasks_.size()) continue;
+        boost::function<void()> task(tasks_[index]);
+        lock.unlock();
+        task();
+        lock.lock();
+        if (--poolPending_ == 0) poolDone_.notify_one();
+      }
+    }
+
+    void PointCloud::stopPool()
+    {
+      {
+        boost::mutex::scoped_lock lock(poolMutex_);
+        poolStop_ = true;
       }
-      pointsInSensorFrame_[pc_id].conservativeResize(iPoint, 3);
+      poolWork_.notify_all();
+      for (std::size_t i=0; i < pool_.size(); ++i) pool_[i]->join();
+      pool_.clear();
+    }
+
+    template <typename Scalar>
+    size_type voxelGridFilter(typename PointMatrix<Scalar>::type& points,
+                              value_type size)
+    {
+      if (size <= 0)
+        throw std::invalid_argument("The size of the voxels must be positive");
+      const size_type kept(voxelGrid<Scalar>(points, 0, points.rows(), size));
+      points.conservativeResize(kept, 3);
+      return kept;
     }
 
+    template size_type voxelGridFilter<float>
+    (PointMatrix<float>::type& points, value_type size);
+    template size_type voxelGridFilter<double>
+    (PointMatrix<double>::type& points, value_type size);
+
     PointCloud::PointCloud(const ProblemSolverPtr_t& ps):
       problemSolver_ (ps),
       waitingForData_(false),
-      handle_(0x0), minDistance_(0), maxDistance_
-      (std::numeric_limits<value_type>::infinity()), display_(true),
+      handle_(0x0), linkMsensor_(Transform3f::Identity()),
+      planePoint_(vector3_t::Zero()), planeNormal_(vector3_t::Zero()),
+      minDistance_(0), maxDistance_
+      (std::numeric_limits<value_type>::infinity()), voxelSize_(0),
+      resolution_(0),
+      nbThreads_(std::max<size_type>(1, boost::thread::hardware_concurrency())),
+      display_(true),
       filterBehindPlan_(false),
       objectPlanMargin_(0),
-      newPointCloud_(false)
+      newPointCloud_(false),
+      poolGeneration_(0), poolPending_(0), poolStop_(false)
       {}
 
-    void PointCloud::movePointCloud(const std::string& octreeFrame,
-				    const std::string& sensorFrame,
-				    const vector_t& configuration)
+    void PointCloud::computeSensorPose(const std::string& octreeFrame,
+                                       const std::string& sensorFrame,
+                                       const vector_t& configuration)
     {
       // Compute forward kinematics for input configuration
       const DevicePtr_t& robot (problemSolver_->robot());
@@ -290,25 +635,232 @@ namespace hpp {
       Transform3f wMs(sf.currentTransformation());
       Transform3f wMo(of.currentTransformation());
       Transform3f oMs(wMo.inverse() * wMs);
-      std::string name(octreeFrame + std::string("/octree"));
-      // Add a GeometryObject to the GeomtryModel
       ::pinocchio::Frame pinOctreeFrame(robot->model().frames[of.index()]);
-      // Move the points from the latest added pointsInSensorFrame_ element
-      size_type before_size = 0;
-      if (newPointCloud_) { // The existing points are replaced by the new points
-        pointsInLinkFrame_.resize(pointsInSensorFrame_.back().rows(), 3);
+      linkMsensor_ = pinOctreeFrame.placement*oMs;
+      // Object plan in the sensor frame
+      Transform3f sMo(oMs.inverse());
+      planePoint_ = sMo.actOnEigenObject(plaquePoint_);
+      planeNormal_ = sMo.rotation() * plaqueNormalVector_;
+    }
+
+    namespace {
+      /// Refresh the parts of the geometry data of the robot that depend on
+      /// the geometry of an object.
+      /// \note must be called with Discretization::geometryMutex locked.
+      void refreshGeometryData(const DevicePtr_t& robot, GeomIndex geomId)
+      {
+#if PINOCCHIO_VERSION_AT_LEAST(2,6,0)
+        typedef shared_ptr<pinocchio::DeviceSync> DeviceSyncPtr_t;
+        const ::pinocchio::GeometryModel& model(robot->geomModel());
+        // Take all the data of the pool so that none of them is in use. The
+        // streaming threads hold one until they are asked to release it.
+        Discretization::releaseDeviceData(true);
+        try {
+          std::vector<DeviceSyncPtr_t> syncs;
+          std::vector< ::pinocchio::GeometryData*> datas
+            (1, &robot->geomData());
+          for (size_type i=0; i < robot->numberDeviceData(); ++i) {
+            syncs.push_back(DeviceSyncPtr_t(new pinocchio::DeviceSync(robot)));
+            datas.push_back(&syncs.back()->geomData());
+          }
+          // The collision and distance functors store the geometries.
+          for (std::size_t k=0; k < model.collisionPairs.size(); ++k) {
+            const CollisionPair& cp(model.collisionPairs[k]);
+            if (cp.first != geomId && cp.second != geomId) continue;
+            const GeometryObject& go1(model.geometryObjects[cp.first]);
+            const GeometryObject& go2(model.geometryObjects[cp.second]);
+            for (std::size_t i=0; i < datas.size(); ++i) {
+              datas[i]->collision_functors[k] =
+                ::pinocchio::ComputeCollision(go1, go2);
+              datas[i]->distance_functors[k] =
+                ::pinocchio::ComputeDistance(go1, go2);
+            }
+          }
+        } catch (...) {
+          Discretization::releaseDeviceData(false);
+          throw;
+        }
+        Discretization::releaseDeviceData(false);
+#else
+        // The geometry data does not depend on the geometries.
+        (void)robot; (void)geomId;
+#endif
+      }
+    } // namespace
+
+    namespace {
+      bool matches(const std::string& name,
+                   const std::vector<std::string>& prefixes)
+      {
+        for (std::size_t i=0; i < prefixes.size(); ++i)
+          if (name.compare(0, prefixes[i].size(), prefixes[i]) == 0)
+            return true;
+        return false;
+      }
+
+      /// Bounding box, in the frame of the parent joint of a geometry, of a
+      /// box expressed in the frame of the geometry.
+      hpp::fcl::AABB jointAABB(const GeometryObject& go,
+                               const hpp::fcl::AABB& aabb)
+      {
+        const vector3_t c(go.placement.act(vector3_t(aabb.center())));
+        const vector3_t e(go.placement.rotation().cwiseAbs() *
+                          vector3_t((aabb.max_ - aabb.min_) / 2));
+        return hpp::fcl::AABB(c - e, c + e);
+      }
+
+      /// Bounding box of a geometry in the frame of its parent joint.
+      hpp::fcl::AABB jointAABB(const GeometryObject& go)
+      {
+        go.geometry->computeLocalAABB();
+        return jointAABB(go, go.geometry->aabb_local);
+      }
 
+      /// Upper bound of the distance between the origin of the frame of a
+      /// joint and its image by the motion of the joint.
+      /// \return infinity if the translation of the joint is not bounded or
+      ///         if the type of the joint is not handled.
+      value_type translationBound(const pinocchio::Model& model, JointIndex j)
+      {
+        static const char* rotations[] = { "JointModelRX", "JointModelRY",
+          "JointModelRZ", "JointModelRevoluteUnaligned", "JointModelRUBX",
+          "JointModelRUBY", "JointModelRUBZ",
+          "JointModelRevoluteUnboundedUnaligned", "JointModelSpherical",
+          "JointModelSphericalZYX" };
+        static const char* prismatics[] = { "JointModelPX", "JointModelPY",
+          "JointModelPZ", "JointModelPrismaticUnaligned" };
+        const std::string type(model.joints[j].shortname());
+        // Number of translation coordinates, first in the configuration.
+        int n(-1);
+        const std::size_t nr(sizeof(rotations)/sizeof(char*)),
+          np(sizeof(prismatics)/sizeof(char*));
+        for (std::size_t i=0; n < 0 && i < nr; ++i)
+          if (type == rotations[i]) n = 0;
+        for (std::size_t i=0; n < 0 && i < np; ++i)
+          if (type == prismatics[i]) n = 1;
+        if (type == "JointModelPlanar") n = 2;
+        if (type == "JointModelFreeFlyer" || type == "JointModelTranslation")
+          n = 3;
+        if (n < 0) return std::numeric_limits<value_type>::infinity();
+        const int iq(model.joints[j].idx_q());
+        value_type d2(0);
+        for (int i=0; i < n; ++i) {
+          const value_type m
+            (std::max(std::abs(model.lowerPositionLimit[iq+i]),
+                      std::abs(model.upperPositionLimit[iq+i])));
+          d2 += m * m;
+        }
+        return std::sqrt(d2);
       }
-      else { // The existing points are kept and the new points are added
-        before_size = pointsInLinkFrame_.rows();
-        size_type new_size = before_size + pointsInSensorFrame_.back().rows();
-        pointsInLinkFrame_.conservativeResize(new_size,3);
+
+      /// Whether joint a is joint j or one of its ancestors.
+      bool isAncestor(const pinocchio::Model& model, JointIndex a,
+                      JointIndex j)
+      {
+        while (j != a && j != 0) j = model.parents[j];
+        return j == a;
       }
-      Transform3f M(pinOctreeFrame.placement*oMs);
-      for (size_type r=0; r < pointsInSensorFrame_.back().rows(); ++r){
-        vector3_t x(pointsInSensorFrame_.back().row(r));
-        pointsInLinkFrame_.row(before_size + r) = M.actOnEigenObject(x);
+
+      /// Bounding box, in the frame of an ancestor of a joint, of all the
+      /// positions of a box attached to the joint.
+      hpp::fcl::AABB reachableAABB(const pinocchio::Model& model,
+                                   JointIndex joint, JointIndex ancestor,
+                                   const hpp::fcl::AABB& box)
+      {
+        if (joint == ancestor) return box;
+        // Distance from the origin of the frame of the joint to the box.
+        value_type r(vector3_t(box.center()).norm() +
+                     vector3_t(box.max_ - box.min_).norm() / 2);
+        // Each joint moves away from its parent of at most the distance
+        // between their origins plus its translation.
+        JointIndex j(joint);
+        for (; model.parents[j] != ancestor; j = model.parents[j])
+          r += model.jointPlacements[j].translation().norm() +
+            translationBound(model, j);
+        r += translationBound(model, j);
+        // The origin of the first joint of the chain, before its motion,
+        // is fixed in the frame of the ancestor.
+        const vector3_t c(model.jointPlacements[j].translation());
+        const vector3_t e(vector3_t::Constant(r));
+        return hpp::fcl::AABB(c - e, c + e);
       }
+    } // namespace
+
+    bool mayCollide(const pinocchio::Model& model,
+                    JointIndex joint1, const hpp::fcl::AABB& box1,
+                    JointIndex joint2, const hpp::fcl::AABB& box2)
+    {
+      JointIndex ancestor(joint1);
+      while (!isAncestor(model, ancestor, joint2))
+        ancestor = model.parents[ancestor];
+      return reachableAABB(model, joint1, ancestor, box1).overlap
+        (reachableAABB(model, joint2, ancestor, box2));
+    }
+
+    namespace {
+      /// Rebuild the map from pairs of geometries to collision pairs, for
+      /// the versions of pinocchio that have it.
+      template <typename Model>
+      auto updateCollisionPairMapping(Model& model, int)
+        -> decltype(model.collisionPairMapping, void())
+      {
+        const Eigen::DenseIndex n((Eigen::DenseIndex)
+                                  model.geometryObjects.size());
+        model.collisionPairMapping.setConstant(n, n, -1);
+        for (std::size_t k=0; k < model.collisionPairs.size(); ++k) {
+          const CollisionPair& cp(model.collisionPairs[k]);
+          model.collisionPairMapping((Eigen::DenseIndex)cp.first,
+                                     (Eigen::DenseIndex)cp.second) = (int)k;
+          model.collisionPairMapping((Eigen::DenseIndex)cp.second,
+                                     (Eigen::DenseIndex)cp.first) = (int)k;
+        }
+      }
+
+      template <typename Model>
+      void updateCollisionPairMapping(Model&, long)
+      {}
+    } // namespace
+
+    std::vector<GeomIndex> collisionGeometries
+    (const pinocchio::Model& model, const pinocchio::GeomModel& geomModel,
+     GeomIndex octreeGeomId, const hpp::fcl::OcTree& octree,
+     const std::vector<std::string>& allow,
+     const std::vector<std::string>& deny)
+    {
+      std::vector<GeomIndex> geometries;
+      // The box of the root cell of the octree covers its whole range: the
+      // box of the occupied cells is used instead.
+      const fcl::shared_ptr<const octomap::OcTree> tree(octree.getTree());
+      if (!tree || tree->size() == 0) return geometries;
+      double x0, y0, z0, x1, y1, z1;
+      tree->getMetricMin(x0, y0, z0);
+      tree->getMetricMax(x1, y1, z1);
+      const GeometryObject& octreeGo(geomModel.geometryObjects[octreeGeomId]);
+      const hpp::fcl::AABB octreeBox(jointAABB(octreeGo, hpp::fcl::AABB
+        (vector3_t(x0, y0, z0), vector3_t(x1, y1, z1))));
+      for (GeomIndex geomId=0; geomId < geomModel.geometryObjects.size();
+           ++geomId) {
+        const GeometryObject& go(geomModel.geometryObjects[geomId]);
+        if (geomId == octreeGeomId) continue;
+        if (go.parentJoint == octreeGo.parentJoint) continue;
+        if (!allow.empty() && !matches(go.name, allow)) continue;
+        if (matches(go.name, deny)) continue;
+        if (!mayCollide(model, octreeGo.parentJoint, octreeBox,
+                        go.parentJoint, jointAABB(go))) continue;
+        geometries.push_back(geomId);
+      }
+      return geometries;
+    }
+
+    std::vector<GeomIndex> PointCloud::collisionGeometries
+    (const OcTreePtr_t& octree, GeomIndex octreeGeomId) const
+    {
+      const DevicePtr_t& robot (problemSolver_->robot());
+      return agimus::collisionGeometries(robot->model(), robot->geomModel(),
+                                         octreeGeomId, *octree,
+                                         collisionAllow_, collisionDeny_);
+    }
+      return geometries;
     }
 
     void PointCloud::attachOctreeToRobot
@@ -316,30 +868,59 @@ namespace hpp {
     {
       const DevicePtr_t& robot (problemSolver_->robot());
       const Frame& of(robot->getFrameByName(octreeFrame));
-      JointIndex octreeJointId(of.pinocchio().parent);
       std::string name(octreeFrame + std::string("/octree"));
       // Add a GeometryObject to the GeomtryModel
       ::pinocchio::Frame pinOctreeFrame(robot->model().frames[of.index()]);
-      // Before adding octree, remove previously inserted one
-      if (robot->geomModel().existGeometryName(name)) {
-	      robot->geomModel().removeGeometryObject(name);
+      // The collision monitor of Discretization reads the geometry.
+      boost::mutex::scoped_lock lock (Discretization::geometryMutex());
+      ::pinocchio::GeometryModel& model(robot->geomModel());
+      if (model.existGeometryName(name)) {
+        GeomIndex octreeGeomId(model.getGeometryId(name));
+        // The new octree may have to be paired with other geometries.
+        std::vector<GeomIndex> paired;
+        for (std::size_t k=0; k < model.collisionPairs.size(); ++k) {
+          const CollisionPair& cp(model.collisionPairs[k]);
+          if (cp.first == octreeGeomId) paired.push_back(cp.second);
+          else if (cp.second == octreeGeomId) paired.push_back(cp.first);
+        }
+        std::sort(paired.begin(), paired.end());
+        if (paired == collisionGeometries(octree, octreeGeomId)) {
+          // Only swap the geometry of the previously inserted octree. The
+          // geometry objects and the collision pairs do not change, so the
+          // problem and the path validations remain valid.
+          // The previous octree is kept until no geometry data uses it.
+          const GeometryObject::CollisionGeometryPtr previous
+            (model.geometryObjects[octreeGeomId].geometry);
+          model.geometryObjects[octreeGeomId].geometry = octree;
+          refreshGeometryData(robot, octreeGeomId);
+          Discretization::geometryChanged();
+          lock.unlock();
+          if (display_){
+            // Display point cloud in gepetto-gui.
+            displayOctree(octree, octreeFrame);
+          }
+          return;
+        }
+        model.removeGeometryObject(name);
       }
       ::pinocchio::GeometryObject octreeGo
 	        (name,std::numeric_limits<FrameIndex>::max(), pinOctreeFrame.parent,
 	        octree, Transform3f::Identity());
-      GeomIndex octreeGeomId(robot->geomModel().addGeometryObject(octreeGo));
-      // Add collision pairs with all objects not attached to the octree joint.
-      for (std::size_t geomId=0; geomId <
-	     robot->geomModel().geometryObjects.size(); ++geomId){
-	      const GeometryObject& go(robot->geomModel().geometryObjects[geomId]);
-        if(go.parentJoint != octreeJointId){
-          assert(octreeGeomId < robot->geomModel().geometryObjects.size());
-          assert(geomId < robot->geomModel().geometryObjects.size());
-          robot->geomModel().addCollisionPair(CollisionPair(octreeGeomId,
-                        geomId));
-        }
-      }
+      GeomIndex octreeGeomId(model.addGeometryObject(octreeGo));
+      // Add collision pairs with the selected objects. As the octree is
+      // new, the pairs do not exist and are appended without searching
+      // the existing ones.
+      const std::vector<GeomIndex> geometries
+        (collisionGeometries(octree, octreeGeomId));
+      model.collisionPairs.reserve(model.collisionPairs.size() +
+                                   geometries.size());
+      for (std::size_t i=0; i < geometries.size(); ++i)
+        model.collisionPairs.push_back(CollisionPair(octreeGeomId,
+                                                     geometries[i]));
+      updateCollisionPairMapping(model, 0);
       robot->createGeomData();
+      Discretization::geometryChanged();
+      lock.unlock();
       // Invalidate constraint graph to force reinitialization before using
       // PathValidation instances stored in the edges.
       manipulation::graph::GraphPtr_t graph(problemSolver_->constraintGraph());
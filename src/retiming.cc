@@ -0,0 +1,427 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <hpp/agimus/retiming.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <hpp/core/path-vector.hh>
+#include <hpp/core/time-parameterization.hh>
+
+namespace hpp {
+  namespace agimus {
+    namespace {
+      const value_type infinity (std::numeric_limits<value_type>::infinity());
+      /// Bound of x = sdot^2 on the intervals where the path does not move.
+      const value_type xMax (1e8);
+
+      /// Set of (x, u) = (sdot^2, sddot) satisfying linear constraints
+      /// alpha x + beta u <= gamma.
+      ///
+      /// For a given x, the admissible u are in [lower(x), upper(x)]. As
+      /// lower is convex and upper concave, the admissible x form an
+      /// interval.
+      class Stage
+      {
+        public:
+          void clear ()
+          {
+            lowers_.clear();
+            uppers_.clear();
+            xmin_ = 0;
+            xmax_ = xMax;
+          }
+
+          void add (value_type alpha, value_type beta, value_type gamma)
+          {
+            if (beta == 0) {
+              if (alpha > 0) xmax_ = std::min (xmax_, gamma / alpha);
+              else if (alpha < 0) xmin_ = std::max (xmin_, gamma / alpha);
+              else if (gamma < 0) xmax_ = -1;
+              return;
+            }
+            // u <= (gamma - alpha x) / beta if beta > 0, >= otherwise.
+            Line l = { -alpha / beta, gamma / beta };
+            (beta > 0 ? uppers_ : lowers_).push_back (l);
+          }
+
+          value_type lower (value_type x) const
+          {
+            value_type u (-infinity);
+            for (std::size_t i = 0; i < lowers_.size(); ++i)
+              u = std::max (u, lowers_[i].a * x + lowers_[i].b);
+            return u;
+          }
+
+          value_type upper (value_type x) const
+          {
+            value_type u (infinity);
+            for (std::size_t i = 0; i < uppers_.size(); ++i)
+              u = std::min (u, uppers_[i].a * x + uppers_[i].b);
+            return u;
+          }
+
+          /// Interval of the admissible x.
+          /// \return false if it is empty.
+          bool range (value_type& lo, value_type& hi) const
+          {
+            if (xmin_ > xmax_) return false;
+            // Maximum of the concave function gap by ternary search.
+            value_type a (xmin_), b (xmax_);
+            for (int i = 0; i < 100 && b - a > 0; ++i) {
+              const value_type m1 (a + (b - a) / 3), m2 (b - (b - a) / 3);
+              if (gap (m1) < gap (m2)) a = m1;
+              else b = m2;
+            }
+            const value_type xm (.5 * (a + b));
+            if (gap (xm) < 0) return false;
+            lo = boundary (xm, xmin_);
+            hi = boundary (xm, xmax_);
+            return true;
+          }
+
+        private:
+          struct Line { value_type a, b; };
+
+          value_type gap (value_type x) const
+          {
+            const value_type g (upper (x) - lower (x));
+            // Tolerate the rounding errors.
+            return (g >= -1e-9 * (1 + std::abs (upper (x))) ? std::max (g, 0.)
+                : g);
+          }
+
+          /// Last admissible x between an admissible \c from and \c to.
+          value_type boundary (value_type from, value_type to) const
+          {
+            if (gap (to) >= 0) return to;
+            for (int i = 0; i < 100; ++i) {
+              const value_type m (.5 * (from + to));
+              if (gap (m) >= 0) from = m;
+              else to = m;
+            }
+            return from;
+          }
+
+          std::vector<Line> lowers_, uppers_;
+          value_type xmin_, xmax_;
+      };
+
+      /// Time law computed by retime.
+      ///
+      /// The raw law S(t) has a constant path acceleration on each interval
+      /// of the grid. It is extended by S(t) = 0 before 0 and S(t) = L after
+      /// its duration T. With a smoothing half width h, the smoothed law is
+      /// the moving average of the raw law over [t - 2h, t], which is
+      /// computed from the primitive I of S. The time law is the smoothed
+      /// law slowed down by a factor c >= 1.
+      class TimeLaw : public core::TimeParameterization
+      {
+        public:
+          TimeLaw (const std::vector<value_type>& t,
+              const std::vector<value_type>& s,
+              const std::vector<value_type>& v,
+              const std::vector<value_type>& a, value_type h)
+            : t_ (t), s_ (s), v_ (v), a_ (a), I_ (t.size(), 0), h_ (h)
+            , c_ (1), vmax_ (*std::max_element (v.begin(), v.end()))
+          {
+            for (std::size_t k = 0; k + 1 < t_.size(); ++k) {
+              const value_type d (t_[k+1] - t_[k]);
+              I_[k+1] = I_[k] + s_[k]*d + v_[k]*d*d/2 + a_[k]*d*d*d/6;
+            }
+          }
+
+          /// Multiply the duration by c.
+          void stretch (value_type c)
+          {
+            c_ *= c;
+          }
+
+          value_type duration () const
+          {
+            return c_ * (t_.back() + 2 * h_);
+          }
+
+          value_type value (const value_type& t) const
+          {
+            return smoothed (t / c_, 0);
+          }
+
+          value_type derivative (const value_type& t,
+              const size_type& order) const
+          {
+            return smoothed (t / c_, order) / std::pow (c_, (value_type) order);
+          }
+
+          value_type derivativeBound (const value_type&,
+              const value_type&) const
+          {
+            return vmax_ / c_;
+          }
+
+          core::TimeParameterizationPtr_t copy () const
+          {
+            return core::TimeParameterizationPtr_t (new TimeLaw (*this));
+          }
+
+        private:
+          /// Derivative of the smoothed law.
+          value_type smoothed (value_type t, size_type order) const
+          {
+            if (order > 3) return 0;
+            if (h_ == 0) return S (t, order);
+            if (order == 0) return (I (t) - I (t - 2*h_)) / (2*h_);
+            return (S (t, order - 1) - S (t - 2*h_, order - 1)) / (2*h_);
+          }
+
+          /// Index of the interval of the grid containing t.
+          std::size_t interval (value_type t) const
+          {
+            std::size_t k (std::upper_bound (t_.begin(), t_.end(), t)
+                - t_.begin());
+            return std::min (k > 0 ? k - 1 : 0, t_.size() - 2);
+          }
+
+          /// Derivative of the raw law.
+          value_type S (value_type t, size_type order) const
+          {
+            if (t <= 0) return 0;
+            if (t >= t_.back()) return (order == 0 ? s_.back() : 0);
+            const std::size_t k (interval (t));
+            const value_type d (t - t_[k]);
+            switch (order) {
+              case 0: return s_[k] + v_[k]*d + a_[k]*d*d/2;
+              case 1: return v_[k] + a_[k]*d;
+              case 2: return a_[k];
+              default: return 0;
+            }
+          }
+
+          /// Primitive of the raw law.
+          value_type I (value_type t) const
+          {
+            if (t <= 0) return 0;
+            if (t >= t_.back()) return I_.back() + s_.back() * (t - t_.back());
+            const std::size_t k (interval (t));
+            const value_type d (t - t_[k]);
+            return I_[k] + s_[k]*d + v_[k]*d*d/2 + a_[k]*d*d*d/6;
+          }
+
+          std::vector<value_type> t_, s_, v_, a_, I_;
+          value_type h_, c_, vmax_;
+      };
+
+      /// Factor by which the duration of the time law must be multiplied
+      /// so that the joints respect their limits.
+      ///
+      /// The derivatives of the joints are evaluated at the given times of
+      /// the law from those of the path at the grid points, linearly
+      /// interpolated: \f$ \dot{q} = q' \dot{s} \f$,
+      /// \f$ \ddot{q} = q'' \dot{s}^2 + q' \ddot{s} \f$ and
+      /// \f$ \dddot{q} = q''' \dot{s}^3 + 3 q'' \dot{s} \ddot{s}
+      /// + q' \dddot{s} \f$. Slowing the law down by c divides them by c,
+      /// c^2 and c^3.
+      value_type stretchFactor (const TimeLaw& law, value_type ds,
+          const std::vector<vector_t>& d1, const std::vector<vector_t>& d2,
+          const std::vector<vector_t>& d3, const vector_t& velocity,
+          const vector_t& acceleration, const vector_t& jerk,
+          const std::vector<value_type>& times)
+      {
+        const std::size_t N (d1.size() - 1);
+        const size_type nv (velocity.size());
+        vector_t p1 (nv), p2 (nv), p3 (nv);
+        value_type c (1);
+        for (std::size_t i = 0; i < times.size(); ++i) {
+          const value_type t (times[i]),
+                           s (law.value (t)),
+                           sd (law.derivative (t, 1)),
+                           sdd (law.derivative (t, 2)),
+                           sddd (law.derivative (t, 3));
+          const std::size_t k (std::min ((std::size_t) std::max (s / ds, 0.),
+                N - 1));
+          const value_type u (std::min (std::max (s / ds - (value_type) k, 0.),
+                1.));
+          p1 = (1 - u) * d1[k] + u * d1[k+1];
+          p2 = (1 - u) * d2[k] + u * d2[k+1];
+          p3 = (1 - u) * d3[k] + u * d3[k+1];
+          for (size_type j = 0; j < nv; ++j) {
+            if (velocity[j] > 0)
+              c = std::max (c, std::abs (p1[j] * sd) / velocity[j]);
+            if (acceleration[j] > 0)
+              c = std::max (c, std::sqrt (std::abs (p2[j] * sd * sd
+                      + p1[j] * sdd) / acceleration[j]));
+            if (jerk.size() > 0 && jerk[j] > 0)
+              c = std::max (c, std::pow (std::abs (p3[j] * sd * sd * sd
+                      + 3 * p2[j] * sd * sdd + p1[j] * sddd) / jerk[j],
+                    1. / 3));
+          }
+        }
+        return c;
+      }
+
+      /// Constraints of the joint limits at a point of the grid.
+      /// \param d1, d2 first and second derivatives of the path with respect
+      ///        to its parameter.
+      void limits (Stage& stage, const vector_t& d1, const vector_t& d2,
+          const vector_t& velocity, const vector_t& acceleration)
+      {
+        stage.clear();
+        for (size_type j = 0; j < velocity.size(); ++j) {
+          const value_type dq (d1[j]), ddq (d2[j]);
+          if (velocity[j] > 0 && dq != 0)
+            stage.add (dq*dq, 0, velocity[j]*velocity[j]);
+          if (acceleration[j] > 0) {
+            stage.add ( ddq,  dq, acceleration[j]);
+            stage.add (-ddq, -dq, acceleration[j]);
+          }
+        }
+      }
+
+      void checkSize (const vector_t& limits, size_type size, const char* name)
+      {
+        if (limits.size() != size) {
+          std::ostringstream os;
+          os << "The " << name << " limits must be of size " << size
+            << ", got " << limits.size();
+          throw std::invalid_argument (os.str());
+        }
+      }
+    }
+
+    PathPtr_t retime (const PathPtr_t& path, const DevicePtr_t& device,
+        const vector_t& velocity, const vector_t& acceleration,
+        const vector_t& jerk, size_type nbSegments)
+    {
+      const size_type nv (device->numberDof());
+      checkSize (velocity, nv, "velocity");
+      checkSize (acceleration, nv, "acceleration");
+      if (jerk.size() > 0) checkSize (jerk, nv, "jerk");
+      if (nbSegments < 1)
+        throw std::invalid_argument ("The number of segments must be "
+            "positive");
+
+      const core::interval_t range (path->timeRange());
+      const std::size_t N ((std::size_t) nbSegments);
+      const value_type L (range.second - range.first), ds (L / (value_type) N);
+
+      // First and second derivatives of the path with respect to its
+      // parameter. The second derivative is computed by finite differences
+      // as not all the paths provide it.
+      std::vector<vector_t> d1 (N+1, vector_t (nv)), d2 (N+1, vector_t (nv));
+      for (std::size_t k = 0; k <= N; ++k)
+        path->derivative (d1[k], std::min (range.first + (value_type) k * ds,
+              range.second), 1);
+      for (std::size_t k = 0; k <= N; ++k) {
+        const std::size_t k0 (k > 0 ? k-1 : 0), k1 (std::min (k+1, N));
+        d2[k] = (d1[k1] - d1[k0]) / ((value_type) (k1 - k0) * ds);
+      }
+
+      Stage stage;
+      // Backward pass: controllable sets of x = sdot^2.
+      std::vector<value_type> xlo (N+1, 0), xhi (N+1, 0);
+      for (std::size_t k = N; k-- > 0;) {
+        limits (stage, d1[k], d2[k], velocity, acceleration);
+        stage.add ( 1,  2*ds,  xhi[k+1]);
+        stage.add (-1, -2*ds, -xlo[k+1]);
+        if (!stage.range (xlo[k], xhi[k])) {
+          std::ostringstream os;
+          os << "The path cannot be retimed within the limits at time "
+            << range.first + (value_type) k * ds;
+          throw std::runtime_error (os.str());
+        }
+      }
+
+      // Forward pass: greatest admissible path acceleration.
+      std::vector<value_type> x (N+1, 0), t (N+1, 0), s (N+1, 0),
+        v (N+1, 0), a (N+1, 0);
+      for (std::size_t k = 0; k < N; ++k) {
+        limits (stage, d1[k], d2[k], velocity, acceleration);
+        stage.add ( 1,  2*ds,  xhi[k+1]);
+        stage.add (-1, -2*ds, -xlo[k+1]);
+        const value_type u (std::max (stage.lower (x[k]),
+              std::min (stage.upper (x[k]), xMax)));
+        x[k+1] = std::min (xhi[k+1], std::max (xlo[k+1], x[k] + 2*ds*u));
+        v[k+1] = std::sqrt (x[k+1]);
+        if (v[k] + v[k+1] <= 0) {
+          std::ostringstream os;
+          os << "The path cannot be retimed: the velocity is null at time "
+            << range.first + (value_type) k * ds;
+          throw std::runtime_error (os.str());
+        }
+        a[k] = (x[k+1] - x[k]) / (2*ds);
+        s[k+1] = (value_type) (k+1) * ds;
+        t[k+1] = t[k] + 2*ds / (v[k] + v[k+1]);
+      }
+
+      // Half width of the moving average spreading the switches of the path
+      // acceleration. A switch changes the acceleration of joint j by up to
+      // 2 a_j, which takes 2 a_j / j_j seconds at the jerk limit.
+      value_type h (0);
+      for (size_type j = 0; j < jerk.size(); ++j)
+        if (jerk[j] > 0 && acceleration[j] > 0)
+          h = std::max (h, acceleration[j] / jerk[j]);
+
+      shared_ptr<TimeLaw> law (new TimeLaw (t, s, v, a, h));
+
+      // The smoothing, and the grid, do not guarantee the limits: check the
+      // final law and slow it down until they hold.
+      std::vector<vector_t> d3 (N+1, vector_t (nv));
+      for (std::size_t k = 0; k <= N; ++k) {
+        const std::size_t k0 (k > 0 ? k-1 : 0), k1 (std::min (k+1, N));
+        d3[k] = (d2[k1] - d2[k0]) / ((value_type) (k1 - k0) * ds);
+      }
+      // The derivatives of the smoothed law are piecewise polynomials,
+      // with breaks at the times of the grid, shifted or not by 2h.
+      std::vector<value_type> times;
+      times.reserve (16 * N + 1);
+      for (std::size_t k = 0; k < N; ++k)
+        for (int i = 0; i < 8; ++i) {
+          const value_type tk (t[k] + (t[k+1] - t[k]) * i / 8);
+          times.push_back (tk);
+          if (h > 0) times.push_back (tk + 2*h);
+        }
+      times.push_back (law->duration());
+      const value_type c (stretchFactor (*law, ds, d1, d2, d3, velocity,
+            acceleration, jerk, times));
+      // The margin absorbs the errors of the sampling.
+      if (c > 1) law->stretch (c * (1 + 1e-6));
+      core::PathVectorPtr_t result (core::PathVector::create
+          (path->outputSize(), path->outputDerivativeSize()));
+      result->appendPath (path);
+      result->timeParameterization (law,
+          core::interval_t (0, law->duration()));
+      return result;
+    }
+  } // namespace agimus
+} // namespace hpp
@@ -47,6 +47,7 @@ namespace hpp {
       {
         discretization_ =
           Discretization::create (server_->problemSolver()->robot());
+        discretization_->problemSolver (server_->problemSolver());
 
         agimus_impl::Discretization* servant =
           new agimus_impl::Discretization (server_->parent(),
@@ -0,0 +1,271 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#define BOOST_TEST_MODULE discretization
+
+#include <boost/test/unit_test.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <hpp/agimus/discretization.hh>
+#include <hpp/agimus/output-sink.hh>
+
+#include "utils.hh"
+
+using namespace hpp::agimus;
+
+namespace {
+  DiscretizationPtr_t makeDiscretization (const DevicePtr_t& device,
+      const MemorySinkPtr_t& sink)
+  {
+    DiscretizationPtr_t d (Discretization::create (device));
+    std::vector<std::string> joints;
+    joints.push_back ("joint1");
+    joints.push_back ("joint2");
+    d->setJointNames (joints);
+    d->addSink (sink);
+    return d;
+  }
+
+  /// Compute the samples first, first + step, ... of a grid.
+  void computeSamples (Discretization* d, std::size_t first,
+      std::size_t step, std::size_t n, value_type dt)
+  {
+    for (std::size_t i = first; i < n; i += step)
+      d->compute ((value_type) i * dt);
+  }
+}
+
+// More threads than DeviceData call compute. Each thread computes its own
+// increasing sequence of times, so its samples must be published in that
+// order, and each sample must be the evaluation of the path at its time.
+BOOST_AUTO_TEST_CASE (concurrent_compute_order)
+{
+  DevicePtr_t device (tests::makeArm());
+  device->numberDeviceData (2);
+  MemorySinkPtr_t sink (MemorySink::create());
+  DiscretizationPtr_t d (makeDiscretization (device, sink));
+  PathPtr_t path (tests::mixedPath (device));
+  d->path (path);
+
+  const std::size_t nbThreads (8), n (2000);
+  const value_type dt (path->length() / (value_type) (n - 1));
+  boost::thread_group threads;
+  for (std::size_t k = 0; k < nbThreads; ++k)
+    threads.create_thread (boost::bind (&computeSamples, d.get(), k,
+          nbThreads, n, dt));
+  threads.join_all();
+
+  const std::vector<value_type>& times (sink->times());
+  const std::vector<vector_t>& q (sink->values ("position"));
+  BOOST_REQUIRE_EQUAL (times.size(), n);
+  BOOST_REQUIRE_EQUAL (q.size(), n);
+  // The sample indices are published in order.
+  const std::vector<std::size_t>& ticks (sink->ticks());
+  BOOST_REQUIRE_EQUAL (ticks.size(), n);
+  for (std::size_t i = 1; i < n; ++i)
+    BOOST_CHECK_EQUAL (ticks[i], ticks[i-1] + 1);
+  BOOST_CHECK (sink->valueTicks ("position") == ticks);
+
+  std::vector<value_type> last (nbThreads, -1);
+  std::vector<bool> seen (n, false);
+  Configuration_t expected (device->configSize());
+  for (std::size_t i = 0; i < n; ++i) {
+    const std::size_t index ((std::size_t) (times[i] / dt + .5));
+    BOOST_REQUIRE (index < n);
+    BOOST_CHECK (!seen[index]);
+    seen[index] = true;
+    const std::size_t k (index % nbThreads);
+    BOOST_CHECK_MESSAGE (times[i] > last[k], "Samples of thread " << k
+        << " published out of order at time " << times[i]);
+    last[k] = times[i];
+
+    BOOST_REQUIRE (path->eval (expected, times[i]));
+    BOOST_CHECK_SMALL ((q[i] - expected).norm(), 1e-12);
+  }
+}
+
+// The configuration and the velocity are continuous through the splice
+// time, and the samples after it follow the new path.
+BOOST_AUTO_TEST_CASE (splice_continuity)
+{
+  DevicePtr_t device (tests::makeArm());
+  MemorySinkPtr_t sink (MemorySink::create());
+  DiscretizationPtr_t d (makeDiscretization (device, sink));
+  vector_t velocity (2);
+  velocity << .5, -.3;
+  d->path (tests::straightPath (device, 0, 0, 1., -.6, 2.));
+  const value_type dt (.01), ts (1.);
+  BOOST_CHECK_EQUAL (d->timeGrid (0, 2., dt), 201);
+  for (size_type i = 0; i < 50; ++i) d->computeSample (i);
+
+  // A path that does not start with the velocity of the current one.
+  BOOST_CHECK_THROW (d->splicePath (tests::straightPath (device, .5, -.3,
+          1., -.3, 1.), ts, 1e-6), std::invalid_argument);
+
+  // A rejected splice leaves the path and the time grid unchanged.
+  {
+    MemorySinkPtr_t sink2 (MemorySink::create());
+    DiscretizationPtr_t d2 (makeDiscretization (device, sink2));
+    d2->path (tests::straightPath (device, 0, 0, 1., -.6, 2.));
+    BOOST_CHECK_EQUAL (d2->timeGrid (2., -2., dt), 201);
+    BOOST_CHECK_THROW (d2->splicePath (tests::straightPath (device, .5, -.3,
+            .75, -.45, .5), ts, 1e-6), std::logic_error);
+    BOOST_CHECK_EQUAL (d2->numberOfSamples(), 201);
+    BOOST_CHECK_EQUAL (d2->timeGrid (0, 2., dt), 201);
+    BOOST_REQUIRE_NO_THROW (d2->computeSample (200));
+    vector_t end (2);
+    end << 1., -.6;
+    BOOST_CHECK_SMALL ((sink2->values ("position").back() - end).norm(),
+        1e-9);
+  }
+
+  // Continue with the same velocity from ts, for 1.5 seconds.
+  d->splicePath (tests::straightPath (device, .5, -.3, 1.25, -.75, 1.5), ts,
+      1e-6);
+  const size_type n (d->numberOfSamples());
+  BOOST_REQUIRE_EQUAL (n, 251);
+  for (size_type i = 50; i < n; ++i) d->computeSample (i);
+
+  const std::vector<vector_t>& q (sink->values ("position")),
+    & v (sink->values ("velocity"));
+  BOOST_REQUIRE_EQUAL ((size_type) q.size(), n);
+  for (size_type i = 0; i < n; ++i) {
+    BOOST_CHECK_SMALL ((v[i] - velocity).norm(), 1e-9);
+    if (i > 0)
+      BOOST_CHECK_SMALL ((q[i] - q[i-1] - dt * velocity).norm(), 1e-9);
+  }
+  vector_t end (2);
+  end << 1.25, -.75;
+  BOOST_CHECK_SMALL ((q.back() - end).norm(), 1e-9);
+}
+
+// The fused evaluation of the configuration and of the velocity gives the
+// same samples as Path::eval and Path::derivative.
+BOOST_AUTO_TEST_CASE (fused_evaluation)
+{
+  DevicePtr_t device (tests::makeArm());
+  device->numberDeviceData (2);
+  PathPtr_t path (tests::mixedPath (device));
+  MemorySinkPtr_t fused (MemorySink::create()),
+    generic (MemorySink::create());
+  DiscretizationPtr_t d0 (makeDiscretization (device, fused)),
+    d1 (makeDiscretization (device, generic));
+  d1->fusedEvaluation (false);
+  DiscretizationPtr_t ds[2] = { d0, d1 };
+  for (std::size_t k = 0; k < 2; ++k) {
+    ds[k]->postureOutputs (Discretization::SecondDerivative);
+    ds[k]->path (path);
+    // The velocity is not continuous at the junctions of the sub-paths, so
+    // the grid avoids them.
+    const size_type n (ds[k]->timeGrid (0, path->length(), 7e-4));
+    for (size_type i = 0; i < n; ++i) ds[k]->computeSample (i);
+  }
+
+  const char* channels[3] = { "position", "velocity", "acceleration" };
+  for (std::size_t c = 0; c < 3; ++c) {
+    const std::vector<vector_t>& a (fused->values (channels[c])),
+      & b (generic->values (channels[c]));
+    BOOST_REQUIRE_EQUAL (a.size(), b.size());
+    BOOST_REQUIRE (!a.empty());
+    for (std::size_t i = 0; i < a.size(); ++i)
+      BOOST_CHECK_MESSAGE ((a[i] - b[i]).norm() < 1e-10, "Channel "
+          << channels[c] << " differs at time " << fused->times()[i] << ": "
+          << a[i].transpose() << " vs " << b[i].transpose());
+  }
+}
+
+// The samples computed with the time scale slow down to a stop with a
+// bounded variation of the scale, hold the configuration, and resume up to
+// the end of the time grid.
+BOOST_AUTO_TEST_CASE (scaled_samples)
+{
+  DevicePtr_t device (tests::makeArm());
+  MemorySinkPtr_t sink (MemorySink::create());
+  DiscretizationPtr_t d (makeDiscretization (device, sink));
+  d->path (tests::straightPath (device, 0, 0, 1., -.6, 2.));
+  const value_type dt (.01), acceleration (2);
+  BOOST_REQUIRE_EQUAL (d->timeGrid (0, 2., dt), 201);
+  d->timeScaleAcceleration (acceleration);
+
+  // The horizon of the collision monitor must cover the deceleration.
+  BOOST_CHECK_THROW (d->collisionMonitor (true, .1, 0),
+      std::invalid_argument);
+
+  size_type i (0);
+  for (; i < 50; ++i) BOOST_REQUIRE (d->computeScaledSample (i, dt));
+  d->timeScale (0);
+  for (; i < 150; ++i) BOOST_REQUIRE (d->computeScaledSample (i, dt));
+  d->timeScale (1);
+  while (d->computeScaledSample (i, dt)) ++i;
+
+  const std::vector<value_type>& times (sink->times());
+  const std::vector<vector_t>& v (sink->values ("velocity"));
+  BOOST_REQUIRE_EQUAL ((size_type) times.size(), i);
+  vector_t velocity (2);
+  velocity << .5, -.3;
+  // The last sample is truncated to the end of the grid.
+  for (std::size_t k = 1; k + 1 < times.size(); ++k) {
+    const value_type scale ((times[k] - times[k-1]) / dt);
+    BOOST_CHECK (scale >= -1e-12 && scale <= 1 + 1e-12);
+    BOOST_CHECK_SMALL ((v[k] - scale * velocity).norm(), 1e-9);
+    if (k > 1) {
+      const value_type previous ((times[k-1] - times[k-2]) / dt);
+      BOOST_CHECK (std::abs (scale - previous) <= acceleration * dt + 1e-9);
+    }
+  }
+  // Stopped: the configuration is held.
+  BOOST_CHECK_EQUAL (times[149], times[148]);
+  BOOST_CHECK_CLOSE (times.back(), 2., 1e-9);
+  BOOST_CHECK (!d->computeScaledSample (i, dt));
+}
+
+// The stamp channel is registered only once stamping is enabled, and it is
+// kept by resetTopics.
+BOOST_AUTO_TEST_CASE (stamp_channel)
+{
+  DevicePtr_t device (tests::makeArm());
+  MemorySinkPtr_t sink (MemorySink::create());
+  DiscretizationPtr_t d (makeDiscretization (device, sink));
+  d->path (tests::straightPath (device, 0, 0, 1., -.6, 2.));
+  BOOST_CHECK_THROW (sink->values ("stamp"), std::invalid_argument);
+  d->compute (0);
+
+  d->timeStamping (true, 0);
+  d->compute (.5);
+  BOOST_CHECK_EQUAL (sink->values ("stamp").size(), 1);
+  BOOST_CHECK_EQUAL (sink->values ("position").size(), 2);
+
+  // The sinks are reset with the channels.
+  d->resetTopics();
+  d->compute (1.);
+  const std::vector<vector_t>& stamps (sink->values ("stamp"));
+  BOOST_REQUIRE_EQUAL (stamps.size(), 1);
+  BOOST_CHECK_EQUAL (stamps[0][0], 1.);
+  BOOST_CHECK_EQUAL (sink->values ("position").size(), 1);
+}
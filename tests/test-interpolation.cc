@@ -0,0 +1,71 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#define BOOST_TEST_MODULE interpolation
+
+#include <boost/test/unit_test.hpp>
+
+#include <hpp/agimus/interpolation.hh>
+
+using namespace hpp::agimus::interpolation;
+
+// exp6 (log6 (M)) = M, including rotations of angle pi and close to it.
+BOOST_AUTO_TEST_CASE (se3_log_exp)
+{
+  const Scalar pi (M_PI);
+  const Scalar angles[] = { 0, 1e-8, .3, 2., pi - 1e-6, pi };
+  const Vector3 axis (Vector3 (1, -2, .5).normalized()), p (.3, -.1, 2.);
+  for (std::size_t i = 0; i < sizeof(angles) / sizeof(Scalar); ++i) {
+    const Quaternion R (AngleAxis (angles[i], axis));
+    const Vector6 nu (log6 (R, p));
+    BOOST_REQUIRE (nu.allFinite());
+    Quaternion R1; Vector3 p1;
+    exp6 (nu, R1, p1);
+    BOOST_CHECK_SMALL ((p1 - p).norm(), 1e-9);
+    BOOST_CHECK_SMALL (R1.angularDistance (R), 1e-9);
+  }
+}
+
+// The interpolation between poses at the ends is the identity.
+BOOST_AUTO_TEST_CASE (se3_interpolation)
+{
+  Vector7 M0, M1, M;
+  M0 << 0, 0, 0, 0, 0, 0, 1;
+  // Half turn around z.
+  M1 << 1, 2, 3, 0, 0, 1, 0;
+  se3 (M0, M1, 0, M);
+  BOOST_CHECK_SMALL ((M - M0).norm(), 1e-12);
+  se3 (M0, M1, 1, M);
+  BOOST_REQUIRE (M.allFinite());
+  BOOST_CHECK_SMALL ((M.head<3>() - M1.head<3>()).norm(), 1e-9);
+  BOOST_CHECK_SMALL (Quaternion (M.tail<4>()).angularDistance
+      (Quaternion (M1.tail<4>())), 1e-9);
+  se3 (M0, M1, .5, M);
+  BOOST_CHECK (M.allFinite());
+}
@@ -0,0 +1,185 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#define BOOST_TEST_MODULE path_evaluator
+
+#include <boost/test/unit_test.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <hpp/pinocchio/configuration.hh>
+#include <hpp/core/time-parameterization/polynomial.hh>
+
+#include <hpp/agimus/path-evaluator.hh>
+
+#include "utils.hh"
+
+using namespace hpp::agimus;
+
+namespace {
+  /// Configuration of the arm on a planar base.
+  Configuration_t planarConfig (value_type x, value_type y,
+      value_type theta, value_type q0, value_type q1)
+  {
+    Configuration_t q (6);
+    q << x, y, std::cos (theta), std::sin (theta), q0, q1;
+    return q;
+  }
+
+  PathPtr_t straight (const DevicePtr_t& device)
+  {
+    return hpp::core::StraightPath::create (device->configSpace(),
+        planarConfig (0, 0, -2.5, 0, 0), planarConfig (1, .5, 2.8, .5, -.3),
+        hpp::core::interval_t (0, 1.2));
+  }
+
+  PathPtr_t interpolated (const DevicePtr_t& device)
+  {
+    hpp::core::InterpolatedPathPtr_t path (hpp::core::InterpolatedPath::create
+        (device, planarConfig (0, 0, 3., 0, 0), planarConfig (1, 1, -1., 1, 0),
+         1.5));
+    path->insert (.4, planarConfig (.2, .5, -2.9, .3, .2));
+    path->insert (1., planarConfig (.7, .6, -2., .6, -.4));
+    return path;
+  }
+
+  /// A straight path with a time parameterization, which is evaluated
+  /// through Path::eval and Path::derivative.
+  PathPtr_t generic (const DevicePtr_t& device)
+  {
+    PathPtr_t path (straight (device)->copy());
+    vector_t param (2);
+    param << 0, 2;
+    path->timeParameterization (hpp::core::TimeParameterizationPtr_t
+        (new hpp::core::timeParameterization::Polynomial (param)),
+        hpp::core::interval_t (0, .6));
+    return path;
+  }
+
+  PathPtr_t vectorOf (const DevicePtr_t& device)
+  {
+    hpp::core::PathVectorPtr_t pv (hpp::core::PathVector::create
+        (device->configSize(), device->numberDof()));
+    pv->appendPath (straight (device));
+    PathPtr_t p (interpolated (device));
+    Configuration_t start (p->initial());
+    pv->appendPath (hpp::core::StraightPath::create (device->configSpace(),
+          pv->end(), start, hpp::core::interval_t (0, .8)));
+    pv->appendPath (p);
+    return pv;
+  }
+
+  typedef PathPtr_t (*Factory_t) (const DevicePtr_t&);
+  const char* names[4] = { "StraightPath", "InterpolatedPath",
+    "time parameterized path", "PathVector" };
+  const Factory_t factories[4] = { &straight, &interpolated, &generic,
+    &vectorOf };
+
+  /// Times of the samples, at the middle of the intervals of a regular
+  /// grid, so that they avoid the junctions of the sub-paths and the
+  /// interpolation points, where the velocity is not continuous.
+  std::vector<value_type> times (const PathPtr_t& path)
+  {
+    const hpp::core::interval_t range (path->timeRange());
+    const std::size_t n (997);
+    std::vector<value_type> t (n);
+    for (std::size_t i = 0; i < n; ++i)
+      t[i] = range.first + ((value_type) i + .5)
+        * (range.second - range.first) / (value_type) n;
+    return t;
+  }
+}
+
+// For each type of path, the fused evaluation gives the configuration and
+// the velocity of Path::eval and Path::derivative.
+BOOST_AUTO_TEST_CASE (fused_equals_eval)
+{
+  DevicePtr_t device (tests::makeArm ("planar"));
+  Configuration_t q (device->configSize()), expected (device->configSize());
+  vector_t v (device->numberDof()), dv (device->numberDof()),
+           dq (device->numberDof());
+  for (std::size_t k = 0; k < 4; ++k) {
+    PathPtr_t path (factories[k] (device));
+    PathEvaluator evaluator;
+    evaluator.path (path, device, true);
+    const std::vector<value_type> t (times (path));
+    // Also evaluate backward to check the lookup of the sub-paths.
+    for (std::size_t pass = 0; pass < 2; ++pass)
+      for (std::size_t j = 0; j < t.size(); ++j) {
+        const value_type time (t[pass == 0 ? j : t.size() - 1 - j]);
+        BOOST_REQUIRE (evaluator (time, q, v));
+        BOOST_REQUIRE (path->eval (expected, time));
+        path->derivative (dv, time, 1);
+        hpp::pinocchio::difference (device, q, expected, dq);
+        BOOST_CHECK_MESSAGE (dq.norm() < 1e-10, names[k]
+            << ": configuration differs at time " << time << ": "
+            << q.transpose() << " vs " << expected.transpose());
+        BOOST_CHECK_MESSAGE ((v - dv).norm() < 1e-10, names[k]
+            << ": velocity differs at time " << time << ": "
+            << v.transpose() << " vs " << dv.transpose());
+      }
+  }
+}
+
+// Print the time of the fused evaluation relatively to Path::eval and
+// Path::derivative, per type of path. Run with --log_level=message.
+BOOST_AUTO_TEST_CASE (fused_gain)
+{
+  using boost::posix_time::microsec_clock;
+  using boost::posix_time::ptime;
+  DevicePtr_t device (tests::makeArm ("planar"));
+  Configuration_t q (device->configSize());
+  vector_t v (device->numberDof());
+  const std::size_t repeat (200);
+  for (std::size_t k = 0; k < 4; ++k) {
+    PathPtr_t path (factories[k] (device));
+    const std::vector<value_type> t (times (path));
+    PathEvaluator evaluator;
+    evaluator.path (path, device, true);
+
+    ptime start (microsec_clock::universal_time());
+    for (std::size_t r = 0; r < repeat; ++r)
+      for (std::size_t j = 0; j < t.size(); ++j)
+        evaluator (t[j], q, v);
+    const value_type fused ((value_type)
+        (microsec_clock::universal_time() - start).total_microseconds());
+
+    start = microsec_clock::universal_time();
+    for (std::size_t r = 0; r < repeat; ++r)
+      for (std::size_t j = 0; j < t.size(); ++j) {
+        path->eval (q, t[j]);
+        path->derivative (v, t[j], 1);
+      }
+    const value_type eval ((value_type)
+        (microsec_clock::universal_time() - start).total_microseconds());
+
+    const value_type n ((value_type) (repeat * t.size()));
+    BOOST_TEST_MESSAGE (names[k] << ": fused " << 1e3 * fused / n
+        << " ns, eval and derivative " << 1e3 * eval / n << " ns, speed-up "
+        << eval / std::max (fused, (value_type) 1));
+  }
+}
@@ -0,0 +1,253 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#define BOOST_TEST_MODULE point_cloud
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+#include <hpp/fcl/octree.h>
+#include <hpp/fcl/shape/geometric_shapes.h>
+
+#include <pinocchio/multibody/geometry.hpp>
+
+#include <hpp/agimus/point-cloud.hh>
+
+#include "utils.hh"
+
+using namespace hpp::agimus;
+using hpp::fcl::AABB;
+
+namespace {
+  typedef PointCloud::Points_t Points_t;
+
+  AABB box (value_type x0, value_type y0, value_type z0,
+      value_type x1, value_type y1, value_type z1)
+  {
+    return AABB (vector3_t (x0, y0, z0), vector3_t (x1, y1, z1));
+  }
+
+  /// A point cloud of random points, some of them with NaN coordinates.
+  /// Each point has a fourth float field. The rows are padded with
+  /// \c padding bytes.
+  sensor_msgs::PointCloud2 randomPointCloud (uint32_t height, uint32_t width,
+      uint32_t padding)
+  {
+    sensor_msgs::PointCloud2 msg;
+    const char* names[4] = { "x", "y", "z", "intensity" };
+    for (uint32_t i = 0; i < 4; ++i) {
+      sensor_msgs::PointField field;
+      field.name = names[i];
+      field.offset = i * (uint32_t) sizeof (float);
+      field.datatype = sensor_msgs::PointField::FLOAT32;
+      field.count = 1;
+      msg.fields.push_back (field);
+    }
+    msg.height = height;
+    msg.width = width;
+    msg.point_step = 4 * (uint32_t) sizeof (float);
+    msg.row_step = width * msg.point_step + padding;
+    msg.is_dense = false;
+    msg.data.resize ((std::size_t) height * msg.row_step);
+    std::srand (0);
+    for (uint32_t r = 0; r < height; ++r) {
+      for (uint32_t c = 0; c < width; ++c) {
+        float p[4];
+        for (int j = 0; j < 4; ++j)
+          p[j] = 4.f * (float) std::rand() / (float) RAND_MAX - 2.f;
+        if (std::rand() % 100 == 0)
+          p[std::rand() % 3] = std::numeric_limits<float>::quiet_NaN();
+        std::memcpy (msg.data.data() + r * msg.row_step + c * msg.point_step,
+            p, sizeof (p));
+      }
+    }
+    return msg;
+  }
+
+  /// Filter the point cloud with 1, 2, 4 and 8 threads and check that the
+  /// points are the same.
+  void checkThreads (const sensor_msgs::PointCloud2& msg)
+  {
+    PointCloudPtr_t pc (PointCloud::create (ProblemSolverPtr_t()));
+    pc->setDistanceBounds (.2, 3.);
+    pc->setVoxelSize (.1);
+    pc->setNumberOfThreads (1);
+    Points_t reference;
+    pc->filterPoints (msg, reference);
+    BOOST_REQUIRE (reference.rows() > 0);
+    // There are 40^3 voxels of size 0.1 in the cube of side 4.
+    BOOST_CHECK (reference.rows() <= 64000);
+    BOOST_CHECK (reference.allFinite());
+    for (size_type n = 2; n <= 8; n *= 2) {
+      pc->setNumberOfThreads (n);
+      // Twice to use the threads of the pool again.
+      for (int k = 0; k < 2; ++k) {
+        Points_t points;
+        pc->filterPoints (msg, points);
+        BOOST_REQUIRE_EQUAL (points.rows(), reference.rows());
+        BOOST_CHECK_MESSAGE (points == reference, "The points differ with "
+            << n << " threads");
+      }
+    }
+  }
+}
+
+// The points are split in ranges of at least 2^15 points filtered in
+// parallel: 300000 points are enough for 8 threads.
+BOOST_AUTO_TEST_CASE (same_points_dense)
+{
+  checkThreads (randomPointCloud (1, 300000, 0));
+}
+
+// The rows of an organized point cloud are padded: the points are read
+// one by one.
+BOOST_AUTO_TEST_CASE (same_points_organized)
+{
+  checkThreads (randomPointCloud (600, 500, 8));
+}
+
+// Boxes of the links of the arm, in the frames of their joints. The box of
+// link2 is at most at 0.2 + |(0.4, 0.05, 0.05)| / 2 = 0.4031 of joint2, and
+// at most at 0.9031 of joint1.
+BOOST_AUTO_TEST_CASE (reachable_geometries)
+{
+  DevicePtr_t device (tests::makeArm());
+  const hpp::pinocchio::Model& model (device->model());
+  const JointIndex joint1 (model.getJointId ("joint1")),
+    joint2 (model.getJointId ("joint2"));
+  const AABB link1 (box (0, -.025, -.025, .5, .025, .025)),
+    link2 (box (0, -.025, -.025, .4, .025, .025));
+
+  // Objects fixed in the world: their boxes are compared.
+  BOOST_CHECK (mayCollide (model, 0, box (0, 0, 0, 1, 1, 1),
+        0, box (.5, .5, .5, 2, 2, 2)));
+  BOOST_CHECK (!mayCollide (model, 0, box (0, 0, 0, 1, 1, 1),
+        0, box (1.5, 0, 0, 2, 1, 1)));
+
+  // Fixed object and link2.
+  BOOST_CHECK (mayCollide (model, 0, box (.8, -.1, -.1, 1, .1, .1),
+        joint2, link2));
+  BOOST_CHECK (!mayCollide (model, 0, box (1, -.1, -.1, 1.2, .1, .1),
+        joint2, link2));
+  BOOST_CHECK (!mayCollide (model, joint2, link2,
+        0, box (-.1, -.1, .95, .1, .1, 1.)));
+  // The sphere swept by link2 and fixed in the frame of joint1 contains
+  // link1.
+  BOOST_CHECK (mayCollide (model, joint1, link1, joint2, link2));
+  // An object held by joint2, at most at 3.2732 of it and at 3.7732 of joint1.
+  const AABB object (box (3, -.1, -.1, 3.2, .1, .1));
+  BOOST_CHECK (mayCollide (model, joint2, object, joint1, link1));
+  BOOST_CHECK (!mayCollide (model, joint2, object,
+        0, box (3.8, -.1, -.1, 4, .1, .1)));
+}
+
+// The sphere swept by a geometry grows with the bounds of the translation
+// of the root joint, and is infinite if they are infinite.
+BOOST_AUTO_TEST_CASE (reachable_geometries_free_flyer)
+{
+  DevicePtr_t device (tests::makeArm ("freeflyer"));
+  hpp::pinocchio::Model& model (device->model());
+  const JointIndex joint2 (model.getJointId ("joint2")),
+    root (model.parents[model.parents[joint2]]);
+  BOOST_REQUIRE_EQUAL (model.joints[root].shortname(), "JointModelFreeFlyer");
+  const int iq (model.joints[root].idx_q());
+  const AABB link2 (box (0, -.025, -.025, .4, .025, .025)),
+    obstacle (box (2.5, -.1, -.1, 3., .1, .1)),
+    far (box (3, -.1, -.1, 4., .1, .1));
+
+  model.lowerPositionLimit.segment<3> (iq).setConstant (-1);
+  model.upperPositionLimit.segment<3> (iq).setConstant (1);
+  // 0.9031 + sqrt(3) = 2.635
+  BOOST_CHECK (mayCollide (model, 0, obstacle, joint2, link2));
+  BOOST_CHECK (!mayCollide (model, 0, far, joint2, link2));
+
+  model.lowerPositionLimit.segment<3> (iq).setConstant
+    (-std::numeric_limits<value_type>::infinity());
+  model.upperPositionLimit.segment<3> (iq).setConstant
+    (std::numeric_limits<value_type>::infinity());
+  BOOST_CHECK (mayCollide (model, 0, far, joint2, link2));
+}
+
+// The octree is bounded by its occupied cells. A geometry fixed in the world
+// is never paired with an octree fixed in the world, even if they overlap.
+BOOST_AUTO_TEST_CASE (octree_geometries)
+{
+  DevicePtr_t device (tests::makeArm());
+  const hpp::pinocchio::Model& model (device->model());
+  hpp::pinocchio::GeomModel& geomModel (device->geomModel());
+  const JointIndex joint2 (model.getJointId ("joint2"));
+  GeomIndex link2 (geomModel.geometryObjects.size());
+  for (GeomIndex i = 0; i < geomModel.geometryObjects.size(); ++i)
+    if (geomModel.geometryObjects[i].parentJoint == joint2) link2 = i;
+  BOOST_REQUIRE (link2 < geomModel.geometryObjects.size());
+
+  const hpp::fcl::shared_ptr<octomap::OcTree> tree
+    (new octomap::OcTree (.05));
+  const hpp::fcl::OcTreePtr_t octree (new hpp::fcl::OcTree (tree));
+  const GeomIndex table (geomModel.addGeometryObject (::pinocchio::GeometryObject
+        ("table", std::numeric_limits<FrameIndex>::max(), 0,
+         hpp::fcl::CollisionGeometryPtr_t (new hpp::fcl::Box (2, 2, .1)),
+         Transform3f::Identity())));
+  const GeomIndex octreeId (geomModel.addGeometryObject
+      (::pinocchio::GeometryObject ("octree",
+        std::numeric_limits<FrameIndex>::max(), 0, octree,
+        Transform3f::Identity())));
+  const std::vector<std::string> all;
+
+  // Empty octree.
+  BOOST_CHECK (collisionGeometries (model, geomModel, octreeId, *octree,
+        all, all).empty());
+
+  // Points on the table, within the reach of link2 (0.9031) but not of
+  // link1 (0.5025).
+  tree->updateNode (.7, 0, 0, true, true);
+  tree->updateNode (.8, .1, 0, true, true);
+  tree->updateInnerOccupancy();
+  std::vector<GeomIndex> geometries (collisionGeometries (model, geomModel,
+        octreeId, *octree, all, all));
+  BOOST_CHECK_EQUAL (geometries.size(), (std::size_t) 1);
+  BOOST_CHECK (std::find (geometries.begin(), geometries.end(), table)
+      == geometries.end());
+  BOOST_CHECK (std::find (geometries.begin(), geometries.end(), link2)
+      != geometries.end());
+  std::vector<std::string> deny (1, geomModel.geometryObjects[link2].name);
+  BOOST_CHECK (collisionGeometries (model, geomModel, octreeId, *octree,
+        all, deny).empty());
+
+  // Points out of reach of the arm, while the root cell of the octree
+  // contains the arm.
+  tree->clear();
+  tree->updateNode (2, 0, 0, true, true);
+  tree->updateInnerOccupancy();
+  BOOST_CHECK (collisionGeometries (model, geomModel, octreeId, *octree,
+        all, all).empty());
+}
@@ -0,0 +1,116 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#define BOOST_TEST_MODULE retiming
+
+#include <boost/test/unit_test.hpp>
+
+#include <hpp/agimus/retiming.hh>
+
+#include "utils.hh"
+
+using namespace hpp::agimus;
+
+namespace {
+  /// Check the velocity, the acceleration and the jerk of a retimed path
+  /// against the limits, the two latter by finite differences of the
+  /// velocity.
+  void checkLimits (const PathPtr_t& path, const vector_t& velocity,
+      const vector_t& acceleration, const vector_t& jerk)
+  {
+    const hpp::core::interval_t range (path->timeRange());
+    const value_type eps (1e-4), margin (1e-3);
+    const size_type nv (velocity.size());
+    vector_t v0 (nv), v1 (nv), v2 (nv), a (nv), j (nv);
+    const std::size_t n (2000);
+    for (std::size_t i = 1; i < n; ++i) {
+      const value_type t (range.first + (value_type) i
+          * (range.second - range.first) / (value_type) n);
+      path->derivative (v0, t - eps, 1);
+      path->derivative (v1, t, 1);
+      path->derivative (v2, t + eps, 1);
+      a = (v2 - v0) / (2 * eps);
+      j = (v2 - 2 * v1 + v0) / (eps * eps);
+      for (size_type k = 0; k < nv; ++k) {
+        BOOST_CHECK_MESSAGE (std::abs (v1[k]) <= velocity[k] * (1 + margin),
+            "Velocity of joint " << k << " is " << v1[k] << " at time " << t);
+        BOOST_CHECK_MESSAGE (std::abs (a[k])
+            <= acceleration[k] * (1 + margin) + 1e-6, "Acceleration of joint "
+            << k << " is " << a[k] << " at time " << t);
+        if (jerk.size() > 0)
+          BOOST_CHECK_MESSAGE (std::abs (j[k]) <= jerk[k] * (1 + margin)
+              + 1e-3, "Jerk of joint " << k << " is " << j[k]
+              << " at time " << t);
+      }
+    }
+  }
+}
+
+// The retimed path follows the geometric path, starts and ends at rest and
+// respects the velocity and acceleration limits.
+BOOST_AUTO_TEST_CASE (velocity_acceleration)
+{
+  DevicePtr_t device (tests::makeArm());
+  PathPtr_t path (tests::straightPath (device, 0, 0, 1., -.6, 1.));
+  vector_t velocity (2), acceleration (2), jerk;
+  velocity << .8, .5;
+  acceleration << 2., 1.;
+  PathPtr_t retimed (retime (path, device, velocity, acceleration, jerk,
+        200));
+  BOOST_REQUIRE (retimed);
+  BOOST_CHECK_EQUAL (retimed->timeRange().first, 0);
+  BOOST_CHECK_SMALL ((retimed->initial() - path->initial()).norm(), 1e-9);
+  BOOST_CHECK_SMALL ((retimed->end() - path->end()).norm(), 1e-9);
+  vector_t v (2);
+  retimed->derivative (v, 0, 1);
+  BOOST_CHECK_SMALL (v.norm(), 1e-9);
+  retimed->derivative (v, retimed->timeRange().second, 1);
+  BOOST_CHECK_SMALL (v.norm(), 1e-9);
+  checkLimits (retimed, velocity, acceleration, jerk);
+}
+
+// With jerk limits, the velocity, the acceleration and the jerk all respect
+// their limits.
+BOOST_AUTO_TEST_CASE (jerk_limits)
+{
+  DevicePtr_t device (tests::makeArm());
+  PathPtr_t path (tests::straightPath (device, 0, 0, 1., -.6, 1.));
+  vector_t velocity (2), acceleration (2), jerk (2);
+  velocity << .8, .5;
+  acceleration << 2., 1.;
+  jerk << 10., 4.;
+  PathPtr_t retimed (retime (path, device, velocity, acceleration, jerk,
+        200));
+  BOOST_REQUIRE (retimed);
+  checkLimits (retimed, velocity, acceleration, jerk);
+
+  // Without the jerk limits, the path is faster.
+  PathPtr_t fast (retime (path, device, velocity, acceleration, vector_t(),
+        200));
+  BOOST_CHECK (fast->length() < retimed->length());
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2018, 2019, 2020 CNRS and Airbus S.A.S
+// Author: Joseph Mirabel
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef HPP_AGIMUS_TESTS_UTILS_HH
+#define HPP_AGIMUS_TESTS_UTILS_HH
+
+#include <hpp/pinocchio/device.hh>
+#include <hpp/pinocchio/urdf/util.hh>
+#include <hpp/core/path-vector.hh>
+#include <hpp/core/straight-path.hh>
+#include <hpp/core/interpolated-path.hh>
+
+namespace hpp {
+  namespace agimus {
+    namespace tests {
+      /// Planar arm with two revolute joints and a box on each link.
+      /// \param rootJoint type of the root joint, as in
+      ///        pinocchio::urdf::loadModelFromString.
+      inline pinocchio::DevicePtr_t makeArm
+      (const std::string& rootJoint = "anchor")
+      {
+        static const char* urdf =
+          "<robot name='arm'>"
+          "  <link name='base'/>"
+          "  <link name='link1'>"
+          "    <inertial><mass value='1'/><origin xyz='0.25 0 0'/>"
+          "      <inertia ixx='0.01' iyy='0.03' izz='0.03' ixy='0' ixz='0' iyz='0'/>"
+          "    </inertial>"
+          "    <collision><origin xyz='0.25 0 0'/>"
+          "      <geometry><box size='0.5 0.05 0.05'/></geometry></collision>"
+          "  </link>"
+          "  <link name='link2'>"
+          "    <inertial><mass value='1'/><origin xyz='0.2 0 0'/>"
+          "      <inertia ixx='0.01' iyy='0.02' izz='0.02' ixy='0' ixz='0' iyz='0'/>"
+          "    </inertial>"
+          "    <collision><origin xyz='0.2 0 0'/>"
+          "      <geometry><box size='0.4 0.05 0.05'/></geometry></collision>"
+          "  </link>"
+          "  <link name='tool'/>"
+          "  <joint name='joint1' type='revolute'>"
+          "    <parent link='base'/><child link='link1'/><axis xyz='0 0 1'/>"
+          "    <limit lower='-3' upper='3' velocity='2' effort='10'/>"
+          "  </joint>"
+          "  <joint name='joint2' type='revolute'>"
+          "    <parent link='link1'/><child link='link2'/><axis xyz='0 0 1'/>"
+          "    <origin xyz='0.5 0 0'/>"
+          "    <limit lower='-3' upper='3' velocity='3' effort='10'/>"
+          "  </joint>"
+          "  <joint name='tool_joint' type='fixed'>"
+          "    <parent link='link2'/><child link='tool'/>"
+          "    <origin xyz='0.4 0 0'/>"
+          "  </joint>"
+          "</robot>";
+        pinocchio::DevicePtr_t device (pinocchio::Device::create ("arm"));
+        pinocchio::urdf::loadModelFromString (device, 0, "", rootJoint, urdf,
+            "<robot name='arm'/>");
+        return device;
+      }
+
+      inline core::PathPtr_t straightPath (const pinocchio::DevicePtr_t& device,
+          value_type q0, value_type q1, value_type p0, value_type p1,
+          value_type length)
+      {
+        pinocchio::Configuration_t a (2), b (2);
+        a << q0, q1;
+        b << p0, p1;
+        return core::StraightPath::create (device->configSpace(), a, b,
+            core::interval_t (0, length));
+      }
+
+      /// Path vector made of straight paths and of an interpolated path.
+      inline core::PathPtr_t mixedPath (const pinocchio::DevicePtr_t& device)
+      {
+        core::PathVectorPtr_t pv (core::PathVector::create
+            (device->configSize(), device->numberDof()));
+        pv->appendPath (straightPath (device, 0, 0, .5, -.3, 1));
+        pinocchio::Configuration_t a (2), b (2), c (2);
+        a << .5, -.3;
+        b << .8, .2;
+        c << 1., .4;
+        core::InterpolatedPathPtr_t interpolated
+          (core::InterpolatedPath::create (device, a, c, 1.5));
+        interpolated->insert (.5, b);
+        pv->appendPath (interpolated);
+        pv->appendPath (straightPath (device, 1., .4, 1.2, 0, .7));
+        return pv;
+      }
+    } // namespace tests
+  } // namespace agimus
+} // namespace hpp
+
+#endif // HPP_AGIMUS_TESTS_UTILS_HH